@@ -0,0 +1,142 @@
+#include "Arena.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <thread>
+
+Arena::Arena() {}
+
+Arena::~Arena() {
+  for (auto block : blocks_) {
+    delete[] block;
+  }
+}
+
+char *Arena::allocateFallback(size_t bytes) {
+  if (bytes > BLOCK_SIZE / 4) {
+    // 大对象单独分配一个block, 避免浪费当前block的剩余空间
+    return allocateNewBlock(bytes);
+  }
+
+  allocPtr_ = allocateNewBlock(BLOCK_SIZE);
+  allocBytesRemaining_ = BLOCK_SIZE;
+
+  char *result = allocPtr_;
+  allocPtr_ += bytes;
+  allocBytesRemaining_ -= bytes;
+  return result;
+}
+
+namespace {
+// allocateAligned的对齐要求, 用于存放节点
+constexpr size_t ALIGN = alignof(std::max_align_t) > sizeof(void *)
+                             ? alignof(std::max_align_t)
+                             : sizeof(void *);
+static_assert((ALIGN & (ALIGN - 1)) == 0, "align must be power of 2");
+} // namespace
+
+char *Arena::allocateAligned(size_t bytes) {
+  size_t currentMod = reinterpret_cast<uintptr_t>(allocPtr_) & (ALIGN - 1);
+  size_t slop = (currentMod == 0 ? 0 : ALIGN - currentMod);
+  size_t needed = bytes + slop;
+  char *result;
+  if (needed <= allocBytesRemaining_) {
+    result = allocPtr_ + slop;
+    allocPtr_ += needed;
+    allocBytesRemaining_ -= needed;
+  } else {
+    // new[]返回的内存总是满足对齐要求
+    result = allocateFallback(bytes);
+  }
+  assert((reinterpret_cast<uintptr_t>(result) & (ALIGN - 1)) == 0);
+  return result;
+}
+
+char *Arena::allocateNewBlock(size_t blockBytes) {
+  char *result = new char[blockBytes];
+  blocks_.push_back(result);
+  blockSizes_.push_back(blockBytes);
+  memoryUsage_ += blockBytes + sizeof(char *);
+  return result;
+}
+
+void Arena::reset() {
+  // 保留第一个标准大小的block, 避免flush之后立刻又向系统申请内存
+  char *reuse = nullptr;
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    if (reuse == nullptr && blockSizes_[i] == BLOCK_SIZE) {
+      reuse = blocks_[i];
+      continue;
+    }
+    delete[] blocks_[i];
+  }
+  blocks_.clear();
+  blockSizes_.clear();
+  memoryUsage_ = 0;
+  allocPtr_ = nullptr;
+  allocBytesRemaining_ = 0;
+  if (reuse != nullptr) {
+    blocks_.push_back(reuse);
+    blockSizes_.push_back(BLOCK_SIZE);
+    memoryUsage_ = BLOCK_SIZE + sizeof(char *);
+    allocPtr_ = reuse;
+    allocBytesRemaining_ = BLOCK_SIZE;
+  }
+}
+
+ConcurrentArena::ConcurrentArena() {
+  // shard数取不小于核数的2的幂
+  size_t cores = std::thread::hardware_concurrency();
+  size_t shardNum = 1;
+  while (shardNum < cores) {
+    shardNum *= 2;
+  }
+  shardMask_ = shardNum - 1;
+  shards_ = std::make_unique<Shard[]>(shardNum);
+}
+
+ConcurrentArena::~ConcurrentArena() {}
+
+ConcurrentArena::Shard &ConcurrentArena::currentShard() {
+  // 线程按创建顺序编号, 连续的线程落在不同的shard上
+  static std::atomic<size_t> nextThread = 0;
+  thread_local size_t threadIndex =
+      nextThread.fetch_add(1, std::memory_order_relaxed);
+  return shards_[threadIndex & shardMask_];
+}
+
+char *ConcurrentArena::allocateAligned(size_t bytes) {
+  // 按ALIGN向上取整, shard中的下一次分配仍然对齐
+  bytes = (bytes + ALIGN - 1) & ~(ALIGN - 1);
+  if (bytes > SHARD_BLOCK_SIZE / 4) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return arena_.allocateAligned(bytes);
+  }
+
+  Shard &shard = currentShard();
+  std::lock_guard<std::mutex> shardLock(shard.mutex);
+  if (bytes > shard.remaining) {
+    // 剩余的空间直接丢弃, 最多浪费SHARD_BLOCK_SIZE / 4
+    std::lock_guard<std::mutex> lock(mutex_);
+    shard.freeBegin = arena_.allocateAligned(SHARD_BLOCK_SIZE);
+    shard.remaining = SHARD_BLOCK_SIZE;
+  }
+  char *result = shard.freeBegin;
+  shard.freeBegin += bytes;
+  shard.remaining -= bytes;
+  assert((reinterpret_cast<uintptr_t>(result) & (ALIGN - 1)) == 0);
+  return result;
+}
+
+void ConcurrentArena::reset() {
+  for (size_t i = 0; i <= shardMask_; ++i) {
+    shards_[i].freeBegin = nullptr;
+    shards_[i].remaining = 0;
+  }
+  arena_.reset();
+}
+
+size_t ConcurrentArena::memoryUsage() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return arena_.memoryUsage();
+}
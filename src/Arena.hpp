@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// 内存池: 只支持分配, 不支持单独释放.
+// memtable的节点全部从arena分配, flush时reset()一次性归还.
+class Arena {
+public:
+  Arena();
+  ~Arena();
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  char *allocate(size_t bytes);
+
+  // 按指针大小对齐, 用于存放节点
+  char *allocateAligned(size_t bytes);
+
+  // 释放除第一个block以外的所有block, 第一个block留给下一轮复用
+  void reset();
+
+  // arena从系统申请的内存总量(近似值)
+  size_t memoryUsage() const { return memoryUsage_; }
+
+private:
+  char *allocateFallback(size_t bytes);
+  char *allocateNewBlock(size_t blockBytes);
+
+private:
+  char *allocPtr_ = nullptr;
+  size_t allocBytesRemaining_ = 0;
+  std::vector<char *> blocks_;
+  std::vector<size_t> blockSizes_; // 与blocks_一一对应
+  size_t memoryUsage_ = 0;
+
+private:
+  static constexpr size_t BLOCK_SIZE = 4096;
+};
+
+inline char *Arena::allocate(size_t bytes) {
+  if (bytes <= allocBytesRemaining_) [[likely]] {
+    char *result = allocPtr_;
+    allocPtr_ += bytes;
+    allocBytesRemaining_ -= bytes;
+    return result;
+  }
+  return allocateFallback(bytes);
+}
+
+/**
+ * 可以被多个线程同时分配的arena, 参考RocksDB的ConcurrentArena:
+ * + 每个线程固定对应一个shard, shard每次从arena_取一段SHARD_BLOCK_SIZE的内存,
+ *   之后在这段内存中分配, 只有对应同一个shard的线程之间才会竞争shard的锁
+ * + mutex_只在shard取新的一段内存以及分配大对象时获取
+ * reset()不能与分配同时进行, 由调用方保证
+ */
+class ConcurrentArena {
+public:
+  ConcurrentArena();
+  ~ConcurrentArena();
+
+  ConcurrentArena(const ConcurrentArena &) = delete;
+  ConcurrentArena &operator=(const ConcurrentArena &) = delete;
+
+  // 与Arena::allocateAligned相同的对齐方式
+  char *allocateAligned(size_t bytes);
+
+  void reset();
+
+  size_t memoryUsage() const;
+
+private:
+  struct alignas(64) Shard {
+    std::mutex mutex;
+    char *freeBegin = nullptr;
+    size_t remaining = 0;
+  };
+
+  Shard &currentShard();
+
+private:
+  mutable std::mutex mutex_; // 保护arena_
+  Arena arena_;
+  size_t shardMask_;
+  std::unique_ptr<Shard[]> shards_;
+
+private:
+  static constexpr size_t SHARD_BLOCK_SIZE = 1024;
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <bitset>
 #include <cassert>
 #include <cstdint>
@@ -13,15 +14,21 @@
 #include <vector>
 
 #include <bit>
+#include <cassert>
 #include <span>
 
 /**
- * + k_len + k + v_len + v + offsets(n对kv则n个offset) + number of kv +
- * + k_len && v_len use uint16_t(2B)+
+ * + entry0 + entry1 + ... + restarts(每个restart点一个offset) + number of restarts +
+ * + entry: shared + unshared + v_len + key[shared:] + v
+ * + shared/unshared/v_len/offset use uint16_t(2B)+
+ * 相邻key共享前缀时只存不同的后缀, 每BLOCK_RESTART_INTERVAL个entry设置一个
+ * restart点, restart点上的entry保存完整的key(shared == 0), 用于二分查找
  */
 // 要求该block的offset不能超过2^16次幂
 
-void put_u16(std::vector<uint8_t> &buf, uint16_t value) {
+inline constexpr size_t BLOCK_RESTART_INTERVAL = 16;
+
+inline void put_u16(std::vector<uint8_t> &buf, uint16_t value) {
   if constexpr (std::endian::native == std::endian::big) {
     buf.push_back(value >> 8);
     buf.push_back(value & 0xFF);
@@ -31,210 +38,295 @@ void put_u16(std::vector<uint8_t> &buf, uint16_t value) {
   }
 }
 
-uint16_t get_u16(uint8_t first, uint8_t second) {
+inline uint16_t get_u16(uint8_t first, uint8_t second) {
   if constexpr (std::endian::native == std::endian::big) {
-    return (first << 8) + second;
+    return static_cast<uint16_t>((first << 8) + second);
   } else {
-    return (second << 8) + first;
+    return static_cast<uint16_t>((second << 8) + first);
+  }
+}
+
+// 与sst中其它字段一致, 按本机字节序存放
+inline void put_u64(std::vector<uint8_t> &buf, uint64_t value) {
+  uint8_t bytes[sizeof(value)];
+  ::memcpy(bytes, &value, sizeof(value));
+  buf.insert(buf.end(), bytes, bytes + sizeof(value));
+}
+
+inline uint64_t get_u64(const uint8_t *ptr) {
+  uint64_t value;
+  ::memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+// 按字节序比较两个key, 返回值同memcmp
+inline int compare_key(std::span<const uint8_t> x, std::span<const uint8_t> y) {
+  size_t len = x.size() < y.size() ? x.size() : y.size();
+  int ret = len == 0 ? 0 : ::memcmp(x.data(), y.data(), len);
+  if (ret == 0 && x.size() != y.size()) {
+    ret = x.size() < y.size() ? -1 : 1;
   }
+  return ret;
 }
 
 // https://stackoverflow.com/questions/70317885/creating-a-concept-for-a-non-template-class-with-template-methods
 struct Block {
-  // using kv = std::pair<std::span<uint8_t>, std::span<uint8_t>>;
-  using iterator_category = std::random_access_iterator_tag;
+  using iterator_category = std::forward_iterator_tag;
 
   struct kv {
-    std::span<uint8_t> key;
-    std::span<uint8_t> value;
+    std::span<const uint8_t> key;
+    std::span<const uint8_t> value;
     friend bool operator==(const kv &x, const kv &y) noexcept {
-      if (x.key.size() != y.key.size()) {
-        return false;
-      }
-      for (size_t i = 0; i < x.key.size(); ++i) {
-        if (x.key[i] != y.key[i]) {
-          return false;
-        }
-      }
-      return true;
+      return compare_key(x.key, y.key) == 0;
     }
   };
 
-  std::vector<uint8_t> data_; // k_len k v_len v
-  std::vector<uint16_t> offsets_;
+  std::vector<uint8_t> data_; // entries
+  std::vector<uint16_t> restarts_;
+  // decode_view时指向外部内存(例如mmap的文件), 此时data_为空
+  const uint8_t *view_ = nullptr;
+  size_t view_size_ = 0;
+
+  std::span<const uint8_t> entries() const {
+    if (view_ != nullptr) {
+      return {view_, view_size_};
+    }
+    return data_;
+  }
 
   std::vector<uint8_t> encode() {
-    auto buf = data_;
-    uint16_t offsets_len = static_cast<uint16_t>(offsets_.size());
-    for (auto &offset : offsets_) {
-      put_u16(buf, offset);
+    auto data = entries();
+    std::vector<uint8_t> buf(data.begin(), data.end());
+    uint16_t restarts_len = static_cast<uint16_t>(restarts_.size());
+    for (auto &restart : restarts_) {
+      put_u16(buf, restart);
     }
 
-    put_u16(buf, offsets_len);
+    put_u16(buf, restarts_len);
     return buf;
   }
 
-  Block &decode(std::vector<uint8_t> data) {
-    uint16_t offsets_len =
-        *reinterpret_cast<uint16_t *>(&data[data.size() - sizeof(uint16_t)]);
-    uint16_t data_end =
-        data.size() - sizeof(uint16_t) - offsets_len * sizeof(uint16_t);
-    auto offsetSpan = std::span<uint8_t>(data.begin() + data_end,
-                                         data.end() - sizeof(uint16_t));
-    for (size_t i = 0; i < offsetSpan.size(); i += 2) {
-      uint16_t offset = get_u16(offsetSpan[i], offsetSpan[i + 1]);
-      this->offsets_.push_back(offset);
-    }
-    std::copy(data.begin(), data.begin() + data_end, this->data_.begin());
+  // 复制entries, 之后不再依赖data
+  Block &decode(std::span<const uint8_t> data) {
+    auto dataSpan = data.subspan(0, decode_restarts(data));
+    this->data_.assign(dataSpan.begin(), dataSpan.end());
+    this->view_ = nullptr;
+    this->view_size_ = 0;
+    return *this;
+  }
+
+  // 不复制entries, 调用方保证data在Block使用期间有效
+  Block &decode_view(std::span<const uint8_t> data) {
+    this->view_size_ = decode_restarts(data);
+    this->view_ = data.data();
+    this->data_.clear();
     return *this;
   }
 
+  // restart点上的entry保存完整的key, 不需要解码前面的entry
+  std::span<const uint8_t> restart_key(size_t i) const {
+    auto data = entries();
+    size_t off = restarts_[i];
+    assert(get_u16(data[off], data[off + 1]) == 0);
+    uint16_t unshared = get_u16(data[off + 2], data[off + 3]);
+    return data.subspan(off + sizeof(uint16_t) * 3, unshared);
+  }
+
+  /**
+   * 前向迭代器: 当前key依赖前一个key的前缀, 因此迭代器自己保存完整的key,
+   * 只能从restart点开始顺序解码
+   */
   struct iterator {
-    using difference_type = int64_t;
-
-    Block *ptr;
-    difference_type index;
-
-    iterator() noexcept : ptr(nullptr), index(0) {}
-    iterator(const iterator &i) noexcept : ptr(i.ptr), index(i.index) {}
-
-    iterator(Block *ptr, difference_type index) noexcept
-        : ptr(ptr), index(index) {}
-
-    kv operator*() const noexcept {
-      assert(index >= 0);
-      uint16_t off = ptr->offsets_[index];
-      uint16_t k_len = get_u16(ptr->data_[off], ptr->data_[off + 1]);
-      off += sizeof(uint16_t);
-      std::span<uint8_t> key(ptr->data_.begin() + off, k_len);
-      off += k_len;
-      uint16_t v_len = get_u16(ptr->data_[off], ptr->data_[off + 1]);
-      off += sizeof(uint16_t);
-      std::span<uint8_t> value(ptr->data_.begin() + off, v_len);
-      return {key, value};
-    }
-
-    kv operator[](difference_type n) const noexcept {
-      assert(n >= 0);
-      uint16_t off = ptr->offsets_[n];
-      uint16_t k_len = get_u16(ptr->data_[off], ptr->data_[off + 1]);
-      off += sizeof(uint16_t);
-      std::span<uint8_t> key(ptr->data_.begin() + off, k_len);
-      off += k_len;
-      uint16_t v_len = get_u16(ptr->data_[off], ptr->data_[off + 1]);
-      off += sizeof(uint16_t);
-      std::span<uint8_t> value(ptr->data_.begin() + off, v_len);
-      return {key, value};
-    }
-
-    iterator &operator++() noexcept {
-      ++index;
-      return *this;
-    }
+    using difference_type = std::ptrdiff_t;
 
-    iterator operator++(int) noexcept {
-      iterator tmp = *this;
-      ++index;
-      return tmp;
+    const Block *ptr = nullptr;
+    size_t offset = 0;      // 当前entry在data_中的位置
+    size_t next_offset = 0; // 下一个entry在data_中的位置
+    std::vector<uint8_t> key;
+    std::span<const uint8_t> value;
+
+    iterator() noexcept {}
+
+    // offset必须是restart点或者data_.size()(end)
+    iterator(const Block *block, size_t off) : ptr(block), offset(off) {
+      parse();
     }
 
-    iterator &operator--() noexcept {
-      --index;
+    kv operator*() const noexcept { return {key, value}; }
+
+    iterator &operator++() {
+      offset = next_offset;
+      parse();
       return *this;
     }
 
-    iterator operator--(int) noexcept {
+    iterator operator++(int) {
       iterator tmp = *this;
-      --index;
+      ++*this;
       return tmp;
     }
 
-    iterator &operator+=(difference_type n) noexcept {
-      index += n;
-      return *this;
+    friend bool operator==(const iterator &x, const iterator &y) noexcept {
+      return x.ptr == y.ptr && x.offset == y.offset;
     }
 
-    iterator &operator-=(difference_type n) noexcept {
-      index -= n;
-      return *this;
+    friend bool operator!=(const iterator &x, const iterator &y) noexcept {
+      return !(x == y);
     }
 
-    iterator operator+(difference_type n) const noexcept {
-      return iterator{this->ptr, this->index + n};
+  private:
+    void parse() {
+      auto data = ptr->entries();
+      if (offset >= data.size()) {
+        offset = next_offset = data.size();
+        key.clear();
+        value = {};
+        return;
+      }
+      size_t off = offset;
+      uint16_t shared = get_u16(data[off], data[off + 1]);
+      uint16_t unshared = get_u16(data[off + 2], data[off + 3]);
+      uint16_t v_len = get_u16(data[off + 4], data[off + 5]);
+      off += sizeof(uint16_t) * 3;
+      assert(shared <= key.size());
+      key.resize(shared);
+      key.insert(key.end(), data.begin() + static_cast<difference_type>(off),
+                 data.begin() + static_cast<difference_type>(off + unshared));
+      off += unshared;
+      value = std::span<const uint8_t>(data.data() + off, v_len);
+      next_offset = off + v_len;
     }
+  };
 
-    iterator operator-(difference_type n) const noexcept {
-      return iterator{this->ptr, this->index - n};
-    }
+  auto begin() const { return iterator{this, 0}; }
 
-    friend difference_type operator-(const iterator &x,
-                                     const iterator &y) noexcept {
-      assert(x.ptr == y.ptr);
-      assert(x.ptr != nullptr && y.ptr != nullptr);
-      return x.index - y.index;
-    }
+  auto end() const { return iterator{this, entries().size()}; }
 
-    friend bool operator==(const iterator &x, const iterator &y) noexcept {
-      return x.ptr == y.ptr && x.index == y.index;
+  // 先在restart点上二分, 再从该restart点顺序查找第一个key >= target的位置
+  iterator lower_bound(std::span<const uint8_t> target) const {
+    if (restarts_.empty()) {
+      return end();
     }
-
-    friend bool operator!=(const iterator &x, const iterator &y) noexcept {
-      return x.ptr == y.ptr && x.index != y.index;
+    // 最后一个key < target的restart点
+    size_t left = 0;
+    size_t right = restarts_.size() - 1;
+    while (left < right) {
+      size_t mid = left + (right - left + 1) / 2;
+      if (compare_key(restart_key(mid), target) < 0) {
+        left = mid;
+      } else {
+        right = mid - 1;
+      }
     }
-  };
+    iterator it{this, restarts_[left]};
+    auto last = end();
+    while (it != last && compare_key(it.key, target) < 0) {
+      ++it;
+    }
+    return it;
+  }
 
-  auto begin() { return iterator{this, 0}; }
+  // pos的前一项, pos是第一项时返回end(). 从pos之前最近的restart点顺序解码
+  iterator before(const iterator &pos) const {
+    auto restart = std::lower_bound(restarts_.begin(), restarts_.end(),
+                                    pos.offset);
+    if (restart == restarts_.begin()) {
+      return end();
+    }
+    iterator it{this, *(restart - 1)};
+    while (it.next_offset < pos.offset) {
+      ++it;
+    }
+    return it;
+  }
 
-  auto end() {
-    return iterator{
-        this, static_cast<iterator::difference_type>(this->offsets_.size())};
+  // 最后一项, 空block返回end()
+  iterator last() const { return before(end()); }
+
+private:
+  // 解析末尾的restarts, 返回entries的长度
+  size_t decode_restarts(std::span<const uint8_t> data) {
+    uint16_t restarts_len = get_u16(data[data.size() - sizeof(uint16_t)],
+                                    data[data.size() - sizeof(uint16_t) + 1]);
+    size_t data_end =
+        data.size() - sizeof(uint16_t) - restarts_len * sizeof(uint16_t);
+    auto restartSpan = data.subspan(data_end, restarts_len * sizeof(uint16_t));
+    this->restarts_.clear();
+    for (size_t i = 0; i < restartSpan.size(); i += 2) {
+      this->restarts_.push_back(get_u16(restartSpan[i], restartSpan[i + 1]));
+    }
+    return data_end;
   }
 };
 
 struct BlockBuilder {
   std::vector<uint8_t> data_;
-  std::vector<uint16_t> offsets_;
+  std::vector<uint16_t> restarts_;
+  std::vector<uint8_t> last_key_;
+  size_t counter_ = 0; // 距离上一个restart点的entry数
   uint16_t block_size_;
+  size_t restart_interval_;
 
-  BlockBuilder(uint16_t block_size) : block_size_(block_size) {}
+  // index block这类需要逐项二分的block可以把restart_interval设为1
+  BlockBuilder(uint16_t block_size,
+               size_t restart_interval = BLOCK_RESTART_INTERVAL)
+      : block_size_(block_size), restart_interval_(restart_interval) {
+    assert(restart_interval_ >= 1);
+  }
 
-  uint16_t estimated_size() {
-    return offsets_.size() * sizeof(uint16_t) + data_.size() + sizeof(uint16_t);
+  void clear() {
+    data_.clear();
+    restarts_.clear();
+    last_key_.clear();
+    counter_ = 0;
   }
 
-  // 退化到uint8_t?
-  bool add(std::span<uint8_t> key, std::span<uint8_t> value) {
+  size_t estimated_size() {
+    return restarts_.size() * sizeof(uint16_t) + data_.size() +
+           sizeof(uint16_t);
+  }
+
+  // key需要按字节序递增, 否则lower_bound的结果无意义
+  bool add(std::span<const uint8_t> key, std::span<const uint8_t> value) {
     assert(key.empty() == false);
-    if (estimated_size() + key.size() + value.size() + sizeof(uint16_t) * 3 >
-            block_size_ &&
-        !empty()) {
-      // k_len/v_len/add a offset(all uint16_t)
+    bool restart = empty() || counter_ >= restart_interval_;
+    size_t shared = 0;
+    if (!restart) {
+      size_t len = std::min(last_key_.size(), key.size());
+      while (shared < len && last_key_[shared] == key[shared]) {
+        ++shared;
+      }
+    }
+    size_t unshared = key.size() - shared;
+    // shared/unshared/v_len(+ restart offset)
+    size_t entry_size = sizeof(uint16_t) * (restart ? 4 : 3) + unshared +
+                        value.size();
+    if (estimated_size() + entry_size > block_size_ && !empty()) {
       return false;
     }
 
-    offsets_.emplace_back(static_cast<uint16_t>(data_.size()));
-    put_u16(data_, static_cast<uint16_t>(key.size()));
-    for (auto &u8 : key) {
-      data_.emplace_back(u8);
+    if (restart) {
+      restarts_.emplace_back(static_cast<uint16_t>(data_.size()));
+      counter_ = 0;
     }
+    put_u16(data_, static_cast<uint16_t>(shared));
+    put_u16(data_, static_cast<uint16_t>(unshared));
     put_u16(data_, static_cast<uint16_t>(value.size()));
-    for (auto &u8 : value) {
-      data_.emplace_back(u8);
-    }
+    data_.insert(data_.end(), key.begin() + static_cast<std::ptrdiff_t>(shared),
+                 key.end());
+    data_.insert(data_.end(), value.begin(), value.end());
+    last_key_.assign(key.begin(), key.end());
+    ++counter_;
     return true;
   }
 
-  bool empty() { return offsets_.empty(); }
+  bool empty() { return data_.empty(); }
 
   Block build() {
     if (empty()) {
       std::abort();
     }
 
-    return Block{.data_ = this->data_, .offsets_ = this->offsets_};
+    return Block{.data_ = this->data_, .restarts_ = this->restarts_};
   }
 };
-
-/**
- * 迭代器:参考std::list和std::vector的++/+=之类的操作
- */
\ No newline at end of file
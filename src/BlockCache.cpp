@@ -0,0 +1,62 @@
+#include "BlockCache.hpp"
+
+BlockCache::BlockCache(size_t capacity) : capacity_(capacity) {
+  size_t perShard = (capacity + NUM_SHARDS - 1) / NUM_SHARDS;
+  for (auto &shard : shards_) {
+    shard.capacity = perShard;
+  }
+}
+
+BlockCache::BlockPtr BlockCache::lookup(uint64_t fileId, uint64_t offset) {
+  CacheKey key{fileId, offset};
+  auto &shard = shardOf(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.index.find(key);
+  if (it == shard.index.end()) {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  hits_.fetch_add(1, std::memory_order_relaxed);
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  return it->second->block;
+}
+
+void BlockCache::insert(uint64_t fileId, uint64_t offset, BlockPtr block) {
+  CacheKey key{fileId, offset};
+  size_t charge = chargeOf(*block);
+  auto &shard = shardOf(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.index.find(key);
+  if (it != shard.index.end()) {
+    // 多个线程同时未命中同一个block
+    shard.usage -= it->second->charge;
+    shard.lru.erase(it->second);
+    shard.index.erase(it);
+  }
+  shard.lru.push_front(Entry{key, std::move(block), charge});
+  shard.index.emplace(key, shard.lru.begin());
+  shard.usage += charge;
+
+  // 淘汰最久未使用的block, 正在被读取的block由shared_ptr保持有效.
+  // 刚插入的block即使超过capacity也保留
+  while (shard.usage > shard.capacity && shard.lru.size() > 1) {
+    auto &victim = shard.lru.back();
+    shard.usage -= victim.charge;
+    shard.index.erase(victim.key);
+    shard.lru.pop_back();
+  }
+}
+
+size_t BlockCache::usage() {
+  size_t total = 0;
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    total += shard.usage;
+  }
+  return total;
+}
+
+size_t BlockCache::chargeOf(const Block &block) {
+  return sizeof(Block) + block.entries().size() +
+         block.restarts_.size() * sizeof(uint16_t);
+}
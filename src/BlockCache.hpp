@@ -0,0 +1,94 @@
+#pragma once
+
+#include "Block.hpp"
+#include "KeyHash.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * sst中data block的缓存, 所有SSTableReader共享:
+ * + 缓存的是解压并解析好的Block, 命中时不需要读文件和解压
+ * + key为(reader的cacheId, block的offset), 每个reader打开时分配新的cacheId
+ * + 按key的hash分成多个shard, 每个shard一把锁和一个LRU链表
+ * + capacity按字节计算, 平均分给每个shard
+ */
+class BlockCache {
+public:
+  using BlockPtr = std::shared_ptr<const Block>;
+
+  explicit BlockCache(size_t capacity);
+
+  BlockCache(const BlockCache &) = delete;
+  BlockCache &operator=(const BlockCache &) = delete;
+
+  // 为新打开的文件分配id
+  uint64_t newId() { return nextId_.fetch_add(1, std::memory_order_relaxed); }
+
+  // 未命中时返回nullptr
+  BlockPtr lookup(uint64_t fileId, uint64_t offset);
+
+  void insert(uint64_t fileId, uint64_t offset, BlockPtr block);
+
+  size_t capacity() const { return capacity_; }
+
+  size_t usage();
+
+  uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+
+  uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+private:
+  struct CacheKey {
+    uint64_t fileId;
+    uint64_t offset;
+    bool operator==(const CacheKey &rhs) const {
+      return fileId == rhs.fileId && offset == rhs.offset;
+    }
+  };
+
+  struct CacheKeyHash {
+    size_t operator()(const CacheKey &key) const {
+      // 高位也要足够分散, 用于选择shard
+      return static_cast<size_t>(
+          fmix64(key.fileId * 0x9E3779B97F4A7C15ull + key.offset));
+    }
+  };
+
+  struct Entry {
+    CacheKey key;
+    BlockPtr block;
+    size_t charge;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    size_t capacity = 0;
+    size_t usage = 0;
+    std::list<Entry> lru; // 越靠前越近被使用
+    std::unordered_map<CacheKey, std::list<Entry>::iterator, CacheKeyHash>
+        index;
+  };
+
+  Shard &shardOf(const CacheKey &key) {
+    size_t hash = CacheKeyHash{}(key);
+    return shards_[hash >> (sizeof(size_t) * 8 - NUM_SHARD_BITS)];
+  }
+
+  static size_t chargeOf(const Block &block);
+
+private:
+  static constexpr int NUM_SHARD_BITS = 4;
+  static constexpr size_t NUM_SHARDS = size_t(1) << NUM_SHARD_BITS;
+
+  size_t capacity_;
+  Shard shards_[NUM_SHARDS];
+  std::atomic<uint64_t> nextId_{1};
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+};
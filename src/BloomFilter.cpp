@@ -0,0 +1,154 @@
+#include "BloomFilter.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TINYKV_BLOOM_AVX2 1
+#endif
+
+namespace {
+
+// 每个word一个salt, 与hash相乘后取高6位作为word内的bit
+alignas(32) constexpr uint32_t SALTS[BloomFilter::WORDS_PER_BLOCK] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+inline uint64_t maskOf(uint32_t hash, size_t i) {
+  return uint64_t(1) << ((hash * SALTS[i]) >> 26);
+}
+
+bool mayContainScalar(const BloomFilter::CacheLine &line, uint32_t hash) {
+  for (size_t i = 0; i < BloomFilter::WORDS_PER_BLOCK; ++i) {
+    uint64_t mask = maskOf(hash, i);
+    if ((line.words[i] & mask) != mask) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#ifdef TINYKV_BLOOM_AVX2
+__attribute__((target("avx2"))) bool
+mayContainAVX2(const BloomFilter::CacheLine &line, uint32_t hash) {
+  __m256i salts = _mm256_load_si256(reinterpret_cast<const __m256i *>(SALTS));
+  __m256i product =
+      _mm256_mullo_epi32(_mm256_set1_epi32(static_cast<int>(hash)), salts);
+  __m256i shift = _mm256_srli_epi32(product, 26);
+  __m256i one = _mm256_set1_epi64x(1);
+  __m256i maskLo = _mm256_sllv_epi64(
+      one, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(shift)));
+  __m256i maskHi = _mm256_sllv_epi64(
+      one, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(shift, 1)));
+  __m256i wordsLo =
+      _mm256_load_si256(reinterpret_cast<const __m256i *>(line.words));
+  __m256i wordsHi =
+      _mm256_load_si256(reinterpret_cast<const __m256i *>(line.words + 4));
+  // testc: (~words & mask) == 0, 即mask中的bit全部为1
+  return _mm256_testc_si256(wordsLo, maskLo) &&
+         _mm256_testc_si256(wordsHi, maskHi);
+}
+
+// 静态初始化早于main, 需要先调用__builtin_cpu_init
+bool detectAVX2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+const bool hasAVX2 = detectAVX2();
+#endif
+
+} // namespace
+
+BloomFilter::BloomFilter(size_t bits)
+    : blocks_((bits + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK + (bits == 0)) {}
+
+void BloomFilter::add(uint64_t hash) {
+  assert(!empty());
+  auto &line = blocks_[blockIndex(hash)];
+  auto low = static_cast<uint32_t>(hash);
+  for (size_t i = 0; i < WORDS_PER_BLOCK; ++i) {
+    line.words[i] |= maskOf(low, i);
+  }
+}
+
+bool BloomFilter::mayContain(uint64_t hash) const {
+  if (empty()) {
+    return true; // 没有过滤器时不能排除任何key
+  }
+  const auto &line = blocks_[blockIndex(hash)];
+  auto low = static_cast<uint32_t>(hash);
+#ifdef TINYKV_BLOOM_AVX2
+  if (hasAVX2) {
+    return mayContainAVX2(line, low);
+  }
+#endif
+  return mayContainScalar(line, low);
+}
+
+void BloomFilter::encodeTo(std::vector<uint8_t> &buf) const {
+  auto bytes = reinterpret_cast<const uint8_t *>(blocks_.data());
+  buf.insert(buf.end(), bytes, bytes + blocks_.size() * sizeof(CacheLine));
+}
+
+bool BloomFilter::decodeFrom(std::span<const uint8_t> data) {
+  if (data.size() % sizeof(CacheLine) != 0) {
+    return false;
+  }
+  blocks_.resize(data.size() / sizeof(CacheLine));
+  if (!blocks_.empty()) {
+    ::memcpy(blocks_.data(), data.data(), data.size());
+  }
+  return true;
+}
+
+bool operator==(const BloomFilter &x, const BloomFilter &y) {
+  return x.blocks_.size() == y.blocks_.size() &&
+         (x.blocks_.empty() ||
+          ::memcmp(x.blocks_.data(), y.blocks_.data(),
+                   x.blocks_.size() * sizeof(BloomFilter::CacheLine)) == 0);
+}
+
+std::vector<double> monkeyBitsPerKey(double bitsPerKey,
+                                     const std::vector<double> &keysPerLevel) {
+  const double ln2Square = std::log(2.0) * std::log(2.0);
+  std::vector<double> result(keysPerLevel.size(), 0.0);
+  std::vector<bool> active(keysPerLevel.size());
+  double budget = 0; // 总bit数
+  for (size_t i = 0; i < keysPerLevel.size(); ++i) {
+    active[i] = keysPerLevel[i] > 0;
+    budget += bitsPerKey * keysPerLevel[i];
+  }
+
+  // 去掉分到负数的层后, 剩余的层重新分配同样的总内存
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    double n = 0;
+    double weightedLog = 0;
+    for (size_t i = 0; i < keysPerLevel.size(); ++i) {
+      if (active[i]) {
+        n += keysPerLevel[i];
+        weightedLog += keysPerLevel[i] * std::log(keysPerLevel[i]);
+      }
+    }
+    if (n == 0) {
+      break;
+    }
+    for (size_t i = 0; i < keysPerLevel.size(); ++i) {
+      if (!active[i]) {
+        result[i] = 0;
+        continue;
+      }
+      result[i] = budget / n +
+                  (weightedLog / n - std::log(keysPerLevel[i])) / ln2Square;
+      if (result[i] < 0) {
+        active[i] = false;
+        changed = true;
+      }
+    }
+  }
+  return result;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/**
+ * 按cache line分块的布隆过滤器(blocked bloom filter):
+ * + 位数组由若干个64B的块组成, hash的高32位选择块,
+ *   同一个key的全部8个bit都落在这一个块内, 一次查询只访问一条cache line
+ * + 块内每个uint64_t恰好置1个bit, 位置由hash的低32位乘以不同的奇数salt得到
+ * + 查询时用SIMD一次算出8个mask并与整个块比较, 不支持时退化为标量实现
+ */
+class BloomFilter {
+public:
+  static constexpr size_t WORDS_PER_BLOCK = 8;
+  static constexpr size_t BITS_PER_BLOCK = WORDS_PER_BLOCK * 64;
+
+  struct alignas(64) CacheLine {
+    uint64_t words[WORDS_PER_BLOCK];
+  };
+
+  BloomFilter() {}
+
+  // 位数向上取整到BITS_PER_BLOCK的倍数, 至少一个块
+  explicit BloomFilter(size_t bits);
+
+  void add(uint64_t hash);
+
+  bool mayContain(uint64_t hash) const;
+
+  size_t bits() const { return blocks_.size() * BITS_PER_BLOCK; }
+
+  bool empty() const { return blocks_.empty(); }
+
+  // 序列化为连续的uint64_t, 与sst中其它字段一致按本机字节序存放
+  void encodeTo(std::vector<uint8_t> &buf) const;
+
+  // 长度不是块大小的整数倍时返回false
+  bool decodeFrom(std::span<const uint8_t> data);
+
+  friend bool operator==(const BloomFilter &x, const BloomFilter &y);
+
+private:
+  size_t blockIndex(uint64_t hash) const {
+    // (hash >> 32) * n >> 32: 把高32位均匀映射到[0, n), 避免取模
+    return static_cast<size_t>(((hash >> 32) * blocks_.size()) >> 32);
+  }
+
+private:
+  std::vector<CacheLine> blocks_;
+};
+
+/**
+ * 按层分配布隆过滤器的bits/key(Monkey):
+ * 总内存bitsPerKey * N不变, 使各层假阳性率之和(即一次不存在的点查
+ * 期望的额外I/O)最小. 最优解中每层的假阳性率与该层key数成正比:
+ *   bits_i = bitsPerKey + (sum(N_j / N * ln N_j) - ln N_i) / ln(2)^2
+ * 层越大分到的bits/key越少, 算出负数的层不使用过滤器.
+ * keysPerLevel为每层(相对的)key数
+ */
+std::vector<double> monkeyBitsPerKey(double bitsPerKey,
+                                     const std::vector<double> &keysPerLevel);
@@ -1,35 +1,57 @@
 #pragma once
 
+#include "Filter.hpp"
+#include "KeyHash.hpp"
 #include "LSMConfig.hpp"
-#include "MurmurHash3.h"
 #include "SSTable.hpp"
 
 #include <algorithm>
-#include <bitset>
+#include <cassert>
 #include <concepts>
-#include <list>
+#include <iterator>
+#include <optional>
 #include <tuple>
 #include <type_traits>
+#include <vector>
 
+/**
+ * 一层sst的元数据:
+ * + level-0的文件之间可能重叠, 按从新到旧排列, 查找时逐个检查
+ * + 其它层的文件之间不重叠, 按maxKey排序, 查找时二分定位唯一可能的文件
+ * 元数据连续存放, 二分查找不需要在链表节点之间跳转
+ */
 template <typename K> struct Cache {
-  std::list<SummaryOfSSTable<K>> cacheOfLayer;
+  std::vector<SummaryOfSSTable<K>> cacheOfLayer;
 
-  // <layer, serialNum, offset In Values>
-  using SearchResultType = std::tuple<uint32_t, uint64_t, uint64_t>;
+  // <layer, serialNum, data block>
+  using SearchResultType = std::tuple<uint32_t, uint64_t, BlockHandle>;
 
-  Cache() {}
+  // learnedIndexError > 0时插入的文件使用学习索引, 见KeyIndex::train
+  explicit Cache(bool overlapping = true, size_t learnedIndexError = 0)
+      : overlapping_(overlapping), learnedIndexError_(learnedIndexError) {}
   ~Cache() {}
 
   template <typename U, typename V>
   requires(std::is_same_v<K, U>)
   void insert(SSTable<U, V> &table, uint32_t layer_, uint64_t serialNum_,
               uint64_t timeStamp_) {
-    SummaryOfSSTable<U> summary(table, layer_, serialNum_, timeStamp_);
-    cacheOfLayer.push_front(summary);
+    insert(SummaryOfSSTable<U>(table, layer_, serialNum_, timeStamp_));
   }
 
-  void insert(const SummaryOfSSTable<K> &summary) {
-    cacheOfLayer.push_front(summary);
+  void insert(SummaryOfSSTable<K> summary) {
+    if (learnedIndexError_ > 0) {
+      summary.fences.train(learnedIndexError_);
+    }
+    if (overlapping_) {
+      cacheOfLayer.insert(cacheOfLayer.begin(), std::move(summary));
+      return;
+    }
+    auto it = std::upper_bound(
+        cacheOfLayer.begin(), cacheOfLayer.end(), summary.maxKey,
+        [](const K &key, auto &&right) { return key < right.maxKey; });
+    assert(it == cacheOfLayer.end() || summary.maxKey < it->minKey);
+    assert(it == cacheOfLayer.begin() || std::prev(it)->maxKey < summary.minKey);
+    cacheOfLayer.insert(it, std::move(summary));
   }
 
   // todo:能否优化?
@@ -43,47 +65,60 @@ template <typename K> struct Cache {
     return false;
   }
 
+  // 删除满足pred的文件, 剩余文件的顺序不变
+  template <typename Pred> size_t removeIf(Pred pred) {
+    return std::erase_if(cacheOfLayer, pred);
+  }
+
+  // 第一个可能包含key的文件, 以及key所在的data block
   template <typename U>
   requires(std::is_same_v<K, U>)
   SearchResultType search(U key) {
-    uint32_t hash[4] = {0};
+    SearchResultType result{LSM_MAX_LAYER + 1, 0, BlockHandle{}};
+    search(key, keyHash(key), [&result](uint32_t layer, uint64_t serialNum,
+                                        BlockHandle block) {
+      result = {layer, serialNum, block};
+      return true;
+    });
+    return result;
+  }
+
+  /**
+   * 按从新到旧的顺序对每个可能包含key的文件调用
+   * probe(layer, serialNum, block), probe返回true时停止.
+   * fence pointer只能定位到block, key是否存在需要probe读取block确认,
+   * probe只需要读取这一个block, 见SSTableReader::getInBlock.
+   * hash为keyHash(key), 由调用方计算一次后在所有层共用
+   */
+  template <typename U, typename Probe>
+  requires(std::is_same_v<K, U>)
+  bool search(U key, uint64_t hash, Probe &&probe) {
+    if (!overlapping_) {
+      // 第一个maxKey >= key的文件
+      auto it = std::lower_bound(
+          cacheOfLayer.begin(), cacheOfLayer.end(), key,
+          [](auto &&left, U value) { return left.maxKey < value; });
+      if (it != cacheOfLayer.end() && !(key < it->minKey)) {
+        if (auto block = searchFile(*it, key, hash); block.has_value()) {
+          return probe(it->layer, it->serialNum, *block);
+        }
+      }
+      return false;
+    }
+
     for (auto it = cacheOfLayer.begin(); it != cacheOfLayer.end(); ++it) {
       // 判断区间是否符合
       if (key > it->maxKey || key < it->minKey) {
         continue;
       }
-
-      MurmurHash3_x86_128(&key, sizeof(key), 1, hash);
-      // todo: use simd
-      if (it->bloom[hash[0] % BLOOM_SIZE] == '0')
-        continue;
-      if (it->bloom[hash[1] % BLOOM_SIZE] == '0')
-        continue;
-      if (it->bloom[hash[2] % BLOOM_SIZE] == '0')
-        continue;
-      if (it->bloom[hash[3] % BLOOM_SIZE] == '0')
-        continue;
-      // std::pair<K, uint64_t>
-      auto result = std::lower_bound(
-          it->keyOffset.begin(), it->keyOffset.end(), key,
-          [](auto &&left, U value) { return left.first < value; });
-      if (result != it->keyOffset.end()) {
-        fmt::print("result->first = {}, result->second = {}\n", result->first,
-                   result->second);
-        if (key == result->first) {
-          fmt::print("low_bound found: key = {}\n", key);
-          return {it->layer, it->serialNum, result->second};
-        } else {
-          fmt::print("low_bound not found: key = {}\n", key);
-          return {LSM_MAX_LAYER + 1, 0, 0};
+      if (auto block = searchFile(*it, key, hash); block.has_value()) {
+        if (probe(it->layer, it->serialNum, *block)) {
+          return true;
         }
-      } else {
-        fmt::print("low_bound not found: key = {}\n", key);
-        return {LSM_MAX_LAYER + 1, 0, 0};
       }
+      // level-0的文件之间可能重叠, 更旧的文件中可能存在该key
     }
-
-    return {LSM_MAX_LAYER + 1, 0, 0};
+    return false;
   }
 
   void clear() { cacheOfLayer.clear(); }
@@ -95,4 +130,23 @@ template <typename K> struct Cache {
 
   const auto cbegin() const { return cacheOfLayer.cbegin(); }
   const auto cend() const { return cacheOfLayer.cend(); }
-};
\ No newline at end of file
+
+private:
+  // key可能在summary对应的文件中时返回所在的data block
+  template <typename U>
+  static std::optional<BlockHandle>
+  searchFile(const SummaryOfSSTable<K> &summary, U key, uint64_t hash) {
+    if (!summary.filter.mayContain(hash)) {
+      return std::nullopt;
+    }
+    size_t pos = summary.fences.lowerBound(key);
+    if (pos == summary.fences.size()) {
+      return std::nullopt;
+    }
+    return summary.blockHandle(pos);
+  }
+
+private:
+  bool overlapping_;
+  size_t learnedIndexError_;
+};
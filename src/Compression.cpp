@@ -0,0 +1,192 @@
+#include "Compression.hpp"
+
+#include <cstring>
+
+namespace {
+
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t MAX_OFFSET = UINT16_MAX;
+constexpr int HASH_BITS = 12;
+
+inline uint32_t load32(const uint8_t *ptr) {
+  uint32_t value;
+  ::memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+inline uint32_t hash32(uint32_t value) {
+  return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+void putVarint32(std::vector<uint8_t> &buf, uint32_t value) {
+  while (value >= 0x80) {
+    buf.push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  buf.push_back(static_cast<uint8_t>(value));
+}
+
+bool getVarint32(const uint8_t *&ptr, const uint8_t *end, uint32_t &value) {
+  value = 0;
+  for (uint32_t shift = 0; shift <= 28 && ptr < end; shift += 7) {
+    uint32_t byte = *ptr++;
+    value |= (byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// 长度 >= 15时, 剩余部分用若干个255加一个 < 255的字节表示
+void putLengthExt(std::vector<uint8_t> &buf, size_t len) {
+  for (len -= 15; len >= 255; len -= 255) {
+    buf.push_back(255);
+  }
+  buf.push_back(static_cast<uint8_t>(len));
+}
+
+bool getLengthExt(const uint8_t *&ptr, const uint8_t *end, size_t &len) {
+  uint8_t byte;
+  do {
+    if (ptr >= end) {
+      return false;
+    }
+    byte = *ptr++;
+    len += byte;
+  } while (byte == 255);
+  return true;
+}
+
+void emitSequence(std::vector<uint8_t> &out, const uint8_t *literals,
+                  size_t literalLen, size_t offset, size_t matchLen) {
+  size_t litNibble = literalLen < 15 ? literalLen : 15;
+  size_t matchNibble = 0;
+  if (matchLen > 0) {
+    matchNibble = matchLen - MIN_MATCH < 15 ? matchLen - MIN_MATCH : 15;
+  }
+  out.push_back(static_cast<uint8_t>((litNibble << 4) | matchNibble));
+  if (litNibble == 15) {
+    putLengthExt(out, literalLen);
+  }
+  out.insert(out.end(), literals, literals + literalLen);
+  if (matchLen == 0) {
+    return; // 最后一个sequence
+  }
+  out.push_back(static_cast<uint8_t>(offset & 0xFF));
+  out.push_back(static_cast<uint8_t>(offset >> 8));
+  if (matchNibble == 15) {
+    putLengthExt(out, matchLen - MIN_MATCH);
+  }
+}
+
+} // namespace
+
+void lzCompress(std::span<const uint8_t> input, std::vector<uint8_t> &output) {
+  const uint8_t *base = input.data();
+  size_t n = input.size();
+  putVarint32(output, static_cast<uint32_t>(n));
+
+  // 记录最近一次出现的4字节前缀的位置 + 1, 0表示没有
+  uint32_t table[1 << HASH_BITS] = {0};
+  size_t anchor = 0;
+  size_t pos = 0;
+  while (pos + MIN_MATCH <= n) {
+    uint32_t seq = load32(base + pos);
+    uint32_t &slot = table[hash32(seq)];
+    size_t candidate = slot;
+    slot = static_cast<uint32_t>(pos + 1);
+    if (candidate == 0 || pos - (candidate - 1) > MAX_OFFSET ||
+        load32(base + candidate - 1) != seq) {
+      ++pos;
+      continue;
+    }
+    --candidate;
+    size_t matchLen = MIN_MATCH;
+    while (pos + matchLen < n &&
+           base[candidate + matchLen] == base[pos + matchLen]) {
+      ++matchLen;
+    }
+    emitSequence(output, base + anchor, pos - anchor, pos - candidate,
+                 matchLen);
+    pos += matchLen;
+    anchor = pos;
+  }
+  emitSequence(output, base + anchor, n - anchor, 0, 0);
+}
+
+bool lzUncompress(std::span<const uint8_t> input,
+                  std::vector<uint8_t> &output) {
+  const uint8_t *ptr = input.data();
+  const uint8_t *end = ptr + input.size();
+  uint32_t rawLen;
+  if (!getVarint32(ptr, end, rawLen)) {
+    return false;
+  }
+  size_t start = output.size();
+  output.reserve(start + rawLen);
+  while (ptr < end) {
+    uint8_t token = *ptr++;
+    size_t literalLen = token >> 4;
+    if (literalLen == 15 && !getLengthExt(ptr, end, literalLen)) {
+      return false;
+    }
+    if (static_cast<size_t>(end - ptr) < literalLen ||
+        output.size() - start + literalLen > rawLen) {
+      return false;
+    }
+    output.insert(output.end(), ptr, ptr + literalLen);
+    ptr += literalLen;
+    if (ptr == end) {
+      break; // 最后一个sequence
+    }
+
+    if (end - ptr < 2) {
+      return false;
+    }
+    size_t offset = ptr[0] | (static_cast<size_t>(ptr[1]) << 8);
+    ptr += 2;
+    size_t matchLen = token & 0x0F;
+    if (matchLen == 15 && !getLengthExt(ptr, end, matchLen)) {
+      return false;
+    }
+    matchLen += MIN_MATCH;
+    if (offset == 0 || offset > output.size() - start ||
+        output.size() - start + matchLen > rawLen) {
+      return false;
+    }
+    // match可能与自身重叠, 只能逐字节复制
+    size_t from = output.size() - offset;
+    for (size_t i = 0; i < matchLen; ++i) {
+      output.push_back(output[from + i]);
+    }
+  }
+  return output.size() - start == rawLen;
+}
+
+CompressionType compressBlock(CompressionType type,
+                              std::span<const uint8_t> input,
+                              std::vector<uint8_t> &output) {
+  if (type == CompressionType::LZ) {
+    size_t start = output.size();
+    lzCompress(input, output);
+    if (output.size() - start < input.size() - input.size() / 8) {
+      return CompressionType::LZ;
+    }
+    output.resize(start);
+  }
+  output.insert(output.end(), input.begin(), input.end());
+  return CompressionType::NoCompression;
+}
+
+bool uncompressBlock(CompressionType type, std::span<const uint8_t> input,
+                     std::vector<uint8_t> &output) {
+  switch (type) {
+  case CompressionType::NoCompression:
+    output.insert(output.end(), input.begin(), input.end());
+    return true;
+  case CompressionType::LZ:
+    return lzUncompress(input, output);
+  }
+  return false;
+}
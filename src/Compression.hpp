@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// sst中每个block的压缩方式, 作为1B的type写在block末尾
+enum class CompressionType : uint8_t {
+  NoCompression = 0,
+  LZ = 1, // 内置的LZ77族编码, 不依赖系统库
+};
+
+/**
+ * 内置LZ编码, 格式参考LZ4的sequence:
+ * + varint(原始长度) + sequence0 + sequence1 + ... +
+ * + sequence: token + [literal长度扩展] + literals + offset(2B) +
+ *   [match长度扩展] +
+ * + token高4位为literal长度, 低4位为match长度 - 4, 等于15时后面跟扩展字节
+ * + 最后一个sequence只有literals
+ */
+void lzCompress(std::span<const uint8_t> input, std::vector<uint8_t> &output);
+
+// 数据损坏时返回false
+bool lzUncompress(std::span<const uint8_t> input, std::vector<uint8_t> &output);
+
+/**
+ * 按type压缩block, 追加到output末尾, 返回实际使用的type:
+ * 压缩后节省不到1/8时直接存原始数据, 省去读取时解压的开销
+ */
+CompressionType compressBlock(CompressionType type,
+                              std::span<const uint8_t> input,
+                              std::vector<uint8_t> &output);
+
+// 未知的type或者数据损坏时返回false
+bool uncompressBlock(CompressionType type, std::span<const uint8_t> input,
+                     std::vector<uint8_t> &output);
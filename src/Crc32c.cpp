@@ -0,0 +1,91 @@
+#include "Crc32c.hpp"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define TINYKV_CRC32C_SSE42 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define TINYKV_CRC32C_ARM 1
+#endif
+
+namespace {
+
+constexpr uint32_t POLY = 0x82f63b78U; // 反转后的Castagnoli多项式
+
+constexpr std::array<uint32_t, 256> makeTable() {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int j = 0; j < 8; ++j) {
+      crc = (crc >> 1) ^ ((crc & 1) ? POLY : 0);
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+constexpr std::array<uint32_t, 256> TABLE = makeTable();
+
+// l为取反之后的中间状态
+uint32_t extendScalar(uint32_t l, const uint8_t *data, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    l = TABLE[(l ^ data[i]) & 0xff] ^ (l >> 8);
+  }
+  return l;
+}
+
+#ifdef TINYKV_CRC32C_SSE42
+__attribute__((target("sse4.2"))) uint32_t
+extendSSE42(uint32_t l, const uint8_t *data, size_t n) {
+  uint64_t l64 = l;
+  for (; n >= 8; n -= 8, data += 8) {
+    uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+    l64 = _mm_crc32_u64(l64, word);
+  }
+  l = static_cast<uint32_t>(l64);
+  for (; n > 0; --n, ++data) {
+    l = _mm_crc32_u8(l, *data);
+  }
+  return l;
+}
+
+// 静态初始化早于main, 需要先调用__builtin_cpu_init
+bool detectSSE42() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.2");
+}
+
+const bool hasSSE42 = detectSSE42();
+#endif
+
+#ifdef TINYKV_CRC32C_ARM
+uint32_t extendARM(uint32_t l, const uint8_t *data, size_t n) {
+  for (; n >= 8; n -= 8, data += 8) {
+    uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+    l = __crc32cd(l, word);
+  }
+  for (; n > 0; --n, ++data) {
+    l = __crc32cb(l, *data);
+  }
+  return l;
+}
+#endif
+
+} // namespace
+
+uint32_t crc32cExtend(uint32_t crc, const uint8_t *data, size_t n) {
+  uint32_t l = crc ^ 0xffffffffU;
+#if defined(TINYKV_CRC32C_SSE42)
+  l = hasSSE42 ? extendSSE42(l, data, n) : extendScalar(l, data, n);
+#elif defined(TINYKV_CRC32C_ARM)
+  l = extendARM(l, data, n);
+#else
+  l = extendScalar(l, data, n);
+#endif
+  return l ^ 0xffffffffU;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * CRC32C(Castagnoli), 用于校验WAL记录:
+ * + x86支持SSE4.2时使用crc32指令, ARMv8编译时开启crc扩展时使用crc32c指令
+ * + 否则查表计算, 结果相同
+ */
+
+// 在crc的基础上继续计算data[0, n), crc32cExtend(0, ...)即为data的crc
+uint32_t crc32cExtend(uint32_t crc, const uint8_t *data, size_t n);
+
+inline uint32_t crc32c(const uint8_t *data, size_t n) {
+  return crc32cExtend(0, data, n);
+}
+
+// 存储的crc经过变换, 避免对包含crc的数据再计算crc时结果退化
+inline uint32_t crc32cMask(uint32_t crc) {
+  return ((crc >> 15) | (crc << 17)) + 0xa282ead8U;
+}
+
+inline uint32_t crc32cUnmask(uint32_t masked) {
+  uint32_t rot = masked - 0xa282ead8U;
+  return (rot >> 17) | (rot << 15);
+}
@@ -0,0 +1,49 @@
+#include "Filter.hpp"
+
+Filter Filter::build(FilterType type, double bitsPerKey,
+                     const std::vector<uint64_t> &hashes) {
+  Filter filter;
+  filter.type_ = type;
+  auto bits = static_cast<size_t>(bitsPerKey * double(hashes.size()));
+  if (bitsPerKey <= 0 || bits == 0) {
+    return filter;
+  }
+  if (type == FilterType::Xor) {
+    filter.xor_ = XorFilter(hashes);
+    return filter;
+  }
+  filter.bloom_ = BloomFilter(bits);
+  for (auto hash : hashes) {
+    filter.bloom_.add(hash);
+  }
+  return filter;
+}
+
+void Filter::encodeTo(std::vector<uint8_t> &buf) const {
+  if (empty()) {
+    return;
+  }
+  if (type_ == FilterType::Xor) {
+    xor_.encodeTo(buf);
+  } else {
+    bloom_.encodeTo(buf);
+  }
+  buf.push_back(static_cast<uint8_t>(type_));
+}
+
+bool Filter::decodeFrom(std::span<const uint8_t> data) {
+  *this = Filter();
+  if (data.empty()) {
+    return true;
+  }
+  auto payload = data.first(data.size() - 1);
+  switch (static_cast<FilterType>(data.back())) {
+  case FilterType::Bloom:
+    type_ = FilterType::Bloom;
+    return bloom_.decodeFrom(payload);
+  case FilterType::Xor:
+    type_ = FilterType::Xor;
+    return xor_.decodeFrom(payload);
+  }
+  return false;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "BloomFilter.hpp"
+#include "KeyHash.hpp"
+#include "XorFilter.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// sst中过滤器的类型, 写在过滤器末尾, 读取时据此选择查询方式
+enum class FilterType : uint8_t {
+  Bloom = 0, // 分块布隆过滤器, 大小由bits/key决定
+  // Xor8, 约9.84 bit/key, 假阳性率约0.39%;
+  // 同样假阳性率的最优布隆过滤器约需要11.5 bit/key, xor约少15%
+  Xor = 1,
+};
+
+/**
+ * sst的过滤器, 根据FilterType使用布隆过滤器或xor过滤器:
+ * | filter data | FilterType(1B) |
+ * 没有过滤器时编码为空, mayContain总是返回true
+ */
+class Filter {
+public:
+  Filter() {}
+
+  // hashes为全部key的keyHash. bitsPerKey <= 0时不生成过滤器,
+  // xor过滤器的大小固定, 只使用bitsPerKey判断是否生成
+  static Filter build(FilterType type, double bitsPerKey,
+                      const std::vector<uint64_t> &hashes);
+
+  bool mayContain(uint64_t hash) const {
+    return type_ == FilterType::Xor ? xor_.mayContain(hash)
+                                    : bloom_.mayContain(hash);
+  }
+
+  FilterType type() const { return type_; }
+
+  size_t bits() const {
+    return type_ == FilterType::Xor ? xor_.bits() : bloom_.bits();
+  }
+
+  bool empty() const {
+    return type_ == FilterType::Xor ? xor_.empty() : bloom_.empty();
+  }
+
+  void encodeTo(std::vector<uint8_t> &buf) const;
+
+  // 类型未知或长度不合法时返回false
+  bool decodeFrom(std::span<const uint8_t> data);
+
+  friend bool operator==(const Filter &x, const Filter &y) {
+    return x.type_ == y.type_ && x.bloom_ == y.bloom_ && x.xor_ == y.xor_;
+  }
+
+private:
+  FilterType type_ = FilterType::Bloom;
+  BloomFilter bloom_;
+  XorFilter xor_;
+};
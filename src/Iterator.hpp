@@ -0,0 +1,274 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * 有序kv的迭代器接口, 用于把不同来源(sst文件, memtable)的数据归并到一起
+ * value()返回的view只在下一次移动迭代器之前有效
+ */
+template <typename K> struct Iterator {
+  virtual ~Iterator() {}
+
+  virtual bool valid() = 0;
+  virtual void seekToFirst() = 0;
+  virtual void seekToLast() = 0;
+  // 定位到第一个key >= target的位置
+  virtual void seek(const K &target) = 0;
+  virtual void next() = 0;
+  virtual void prev() = 0;
+  virtual K key() = 0;
+  virtual std::string_view value() = 0;
+};
+
+/**
+ * 基于堆的多路归并:
+ * + children按新旧排列, 下标越小越新
+ * + key相同时先输出更新的child, 调用方跳过后面重复的key即可丢弃旧版本,
+ *   反向遍历时同样先输出更新的child
+ * + 每个child只缓存当前位置的数据, 内存占用与输入大小无关
+ * + 改变方向时把其它child重新定位到当前key的另一侧
+ */
+template <typename K> struct MergingIterator : Iterator<K> {
+  using ChildType = std::unique_ptr<Iterator<K>>;
+
+  explicit MergingIterator(std::vector<ChildType> children)
+      : children_(std::move(children)) {}
+
+  bool valid() override { return !heap_.empty(); }
+
+  void seekToFirst() override {
+    for (auto &child : children_) {
+      child->seekToFirst();
+    }
+    rebuild(true);
+  }
+
+  void seekToLast() override {
+    for (auto &child : children_) {
+      child->seekToLast();
+    }
+    rebuild(false);
+  }
+
+  void seek(const K &target) override {
+    for (auto &child : children_) {
+      child->seek(target);
+    }
+    rebuild(true);
+  }
+
+  void next() override {
+    assert(valid());
+    if (!forward_) {
+      // 其它child都在key()之前, 移动到key()之后
+      K current = key();
+      size_t top = heap_.front();
+      for (size_t i = 0; i < children_.size(); ++i) {
+        if (i == top) {
+          continue;
+        }
+        children_[i]->seek(current);
+        if (children_[i]->valid() && children_[i]->key() == current) {
+          children_[i]->next();
+        }
+      }
+      children_[top]->next();
+      rebuild(true);
+      return;
+    }
+    size_t top = pop();
+    children_[top]->next();
+    if (children_[top]->valid()) {
+      push(top);
+    }
+  }
+
+  void prev() override {
+    assert(valid());
+    if (forward_) {
+      // 其它child都在key()之后(或等于key()的旧版本), 移动到key()之前
+      K current = key();
+      size_t top = heap_.front();
+      for (size_t i = 0; i < children_.size(); ++i) {
+        if (i == top) {
+          continue;
+        }
+        children_[i]->seek(current);
+        if (children_[i]->valid()) {
+          children_[i]->prev();
+        } else {
+          children_[i]->seekToLast();
+        }
+      }
+      children_[top]->prev();
+      rebuild(false);
+      return;
+    }
+    size_t top = pop();
+    children_[top]->prev();
+    if (children_[top]->valid()) {
+      push(top);
+    }
+  }
+
+  K key() override {
+    assert(valid());
+    return children_[heap_.front()]->key();
+  }
+
+  std::string_view value() override {
+    assert(valid());
+    return children_[heap_.front()]->value();
+  }
+
+private:
+  // 堆顶是下一个输出的child: 正向时key小的在前, 反向时key大的在前,
+  // key相同则更新的(下标小的)在前
+  bool after(size_t left, size_t right) {
+    K leftKey = children_[left]->key();
+    K rightKey = children_[right]->key();
+    if (leftKey == rightKey) {
+      return left > right;
+    }
+    return forward_ ? rightKey < leftKey : leftKey < rightKey;
+  }
+
+  void rebuild(bool forward) {
+    forward_ = forward;
+    heap_.clear();
+    for (size_t i = 0; i < children_.size(); ++i) {
+      if (children_[i]->valid()) {
+        push(i);
+      }
+    }
+  }
+
+  void push(size_t child) {
+    heap_.push_back(child);
+    std::push_heap(heap_.begin(), heap_.end(),
+                   [this](size_t l, size_t r) { return after(l, r); });
+  }
+
+  size_t pop() {
+    std::pop_heap(heap_.begin(), heap_.end(),
+                  [this](size_t l, size_t r) { return after(l, r); });
+    size_t top = heap_.back();
+    heap_.pop_back();
+    return top;
+  }
+
+private:
+  std::vector<ChildType> children_;
+  std::vector<size_t> heap_; // children_的下标
+  bool forward_ = true;
+};
+
+/**
+ * 按顺序连接key范围互不重叠的多个迭代器, 例如level-1及以下的一层sst:
+ * + maxKeys[i]为第i个child的最大key, 升序
+ * + child在第一次进入时才由open(i)创建, seek只需要定位一个child
+ */
+template <typename K> struct ConcatIterator : Iterator<K> {
+  using ChildType = std::unique_ptr<Iterator<K>>;
+  using OpenFunc = std::function<ChildType(size_t)>;
+
+  ConcatIterator(std::vector<K> maxKeys, OpenFunc open)
+      : maxKeys_(std::move(maxKeys)), open_(std::move(open)),
+        children_(maxKeys_.size()) {}
+
+  bool valid() override { return current_ != nullptr && current_->valid(); }
+
+  void seekToFirst() override {
+    setCurrent(0);
+    if (current_ != nullptr) {
+      current_->seekToFirst();
+    }
+    skipEmptyForward();
+  }
+
+  void seekToLast() override {
+    setCurrent(maxKeys_.size() - 1);
+    if (current_ != nullptr) {
+      current_->seekToLast();
+    }
+    skipEmptyBackward();
+  }
+
+  void seek(const K &target) override {
+    // 第一个maxKey >= target的child
+    auto it = std::lower_bound(maxKeys_.begin(), maxKeys_.end(), target);
+    setCurrent(static_cast<size_t>(it - maxKeys_.begin()));
+    if (current_ != nullptr) {
+      current_->seek(target);
+    }
+    skipEmptyForward();
+  }
+
+  void next() override {
+    assert(valid());
+    current_->next();
+    skipEmptyForward();
+  }
+
+  void prev() override {
+    assert(valid());
+    current_->prev();
+    skipEmptyBackward();
+  }
+
+  K key() override {
+    assert(valid());
+    return current_->key();
+  }
+
+  std::string_view value() override {
+    assert(valid());
+    return current_->value();
+  }
+
+private:
+  // 越界(包括-1)时current_为空
+  void setCurrent(size_t index) {
+    index_ = index;
+    if (index >= children_.size()) {
+      current_ = nullptr;
+      return;
+    }
+    if (children_[index] == nullptr) {
+      children_[index] = open_(index);
+    }
+    current_ = children_[index].get();
+  }
+
+  void skipEmptyForward() {
+    while (current_ != nullptr && !current_->valid()) {
+      setCurrent(index_ + 1);
+      if (current_ != nullptr) {
+        current_->seekToFirst();
+      }
+    }
+  }
+
+  void skipEmptyBackward() {
+    while (current_ != nullptr && !current_->valid()) {
+      setCurrent(index_ - 1); // index_为0时回绕为SIZE_MAX, 即越界
+      if (current_ != nullptr) {
+        current_->seekToLast();
+      }
+    }
+  }
+
+private:
+  std::vector<K> maxKeys_;
+  OpenFunc open_;
+  std::vector<ChildType> children_;
+  size_t index_ = 0;
+  Iterator<K> *current_ = nullptr;
+};
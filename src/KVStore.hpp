@@ -6,58 +6,223 @@
 #include "LSMConfig.hpp"
 #include "SSTable.hpp"
 #include "SkipList.hpp"
+#include "TableCache.hpp"
+#include "WAL.hpp"
+#include "WriteBatch.hpp"
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <charconv>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <filesystem>
+#include <functional>
 #include <fstream>
 #include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <span>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
 
 namespace fs = std::filesystem;
 
+/**
+ * KVStore::newIterator返回的迭代器: 在MergingIterator之上
+ * + 同一个key只输出最新的版本
+ * + 最新版本是墓碑的key整个跳过
+ * 正向和反向遍历时MergingIterator都先输出key的最新版本
+ */
+template <typename K> struct KVStoreIterator : Iterator<K> {
+  explicit KVStoreIterator(std::unique_ptr<MergingIterator<K>> iter)
+      : iter_(std::move(iter)) {}
+
+  bool valid() override { return iter_->valid(); }
+
+  void seekToFirst() override {
+    iter_->seekToFirst();
+    skipDeletedForward();
+  }
+
+  void seekToLast() override {
+    iter_->seekToLast();
+    skipDeletedBackward();
+  }
+
+  void seek(const K &target) override {
+    iter_->seek(target);
+    skipDeletedForward();
+  }
+
+  void next() override {
+    assert(valid());
+    skipKey(iter_->key(), true);
+    skipDeletedForward();
+  }
+
+  void prev() override {
+    assert(valid());
+    skipKey(iter_->key(), false);
+    skipDeletedBackward();
+  }
+
+  K key() override { return iter_->key(); }
+
+  std::string_view value() override { return iter_->value(); }
+
+private:
+  // 跳过key的所有版本
+  void skipKey(K key, bool forward) {
+    while (iter_->valid() && iter_->key() == key) {
+      forward ? iter_->next() : iter_->prev();
+    }
+  }
+
+  bool isDeleted() { return iter_->value() == std::string_view("~DELETED~"); }
+
+  void skipDeletedForward() {
+    while (iter_->valid() && isDeleted()) {
+      skipKey(iter_->key(), true);
+    }
+  }
+
+  void skipDeletedBackward() {
+    while (iter_->valid() && isDeleted()) {
+      skipKey(iter_->key(), false);
+    }
+  }
+
+private:
+  std::unique_ptr<MergingIterator<K>> iter_;
+};
+
+/**
+ * 线程安全: put/get/del可以被多个线程同时调用.
+ * + 普通的put/get只持有mutex_的共享锁, 内存表本身是无锁的并发SkipList
+ * + memTable写满之后切换为immutable memtable, 由后台线程写成level-0的sst
+ * + 只有等待flush的immutable memtable达到上限时写线程才会阻塞
+ */
 template <typename K, typename V> struct KVStore {
   using LayerSerial = std::pair<uint32_t, uint64_t>;
 
-  KVStore(std::string dataDirectory = "./");
+  KVStore(std::string dataDirectory = "./", Options options = {});
 
   ~KVStore();
 
-  bool put(K key, V value);
+  // value超过MAX_VALUE_SIZE时不写入, 返回false
+  bool put(K key, V value, const WriteOptions &writeOptions = WriteOptions());
 
   std::pair<bool, V> get(K key);
 
-  bool del(K key);
+  // 批量get, 结果与keys一一对应. 每个sst和data block最多读取一次
+  std::vector<std::pair<bool, V>> multiGet(std::span<const K> keys);
+
+  bool del(K key, const WriteOptions &writeOptions = WriteOptions());
+
+  /**
+   * 一次写入batch中的所有修改: 一条WAL记录, 崩溃后全部恢复或全部丢失.
+   * 并发的get可能看到只插入了一部分的batch
+   */
+  void write(const WriteBatch<K> &batch,
+             const WriteOptions &writeOptions = WriteOptions());
+
+  // 等待之前的写入都已经写入WAL文件
+  void flushWAL();
+
+  // 之前的写入(包括!sync的写入)全部落盘, disableWAL的写入除外
+  void syncWAL();
+
+  /**
+   * 归并memtable, immutable memtable和所有层的sst, 支持正向和反向遍历.
+   * 创建时固定当时的memtable和sst文件, 之后的flush和compaction不影响它;
+   * 当前memtable上并发的写入可能被看到. data block在遍历到时才读取.
+   * 迭代器必须在KVStore析构之前销毁
+   */
+  std::unique_ptr<Iterator<K>> newIterator();
+
+  // [start, end]中所有存在的kv, 按key升序
+  std::vector<std::pair<K, V>> scan(K start, K end);
+
+  // 未启用block cache时返回nullptr
+  BlockCache *blockCache() { return blockCache_.get(); }
 
 private:
-  void compaction();
+  // 等待flush的memtable和它对应的WAL编号
+  struct ImmutableMemTable {
+    std::shared_ptr<SkipList<K, V>> table;
+    uint64_t logNumber;
+  };
+
+  // 一次compaction: 把layer层的部分文件与layer + 1层重叠的文件合并到layer + 1层
+  struct CompactionTask {
+    uint32_t layer;
+    std::vector<LayerSerial> inputs; // 两层中参与合并的文件
+    K minKey;                        // inputs的key范围
+    K maxKey;
+    uint64_t maxTimestamp;
+    bool isBottom; // 输出层之下没有数据, 可以丢弃墓碑
+  };
+
+  void makeRoomForWrite(size_t writeSize);
+
+  void backgroundFlush();
+
+  template <typename NextFile>
+  void writeLevel0(const std::shared_ptr<SkipList<K, V>> &table,
+                   double bitsPerKey, NextFile &&nextFile,
+                   std::vector<SummaryOfSSTable<K>> &outputs);
+
+  void maybeScheduleCompaction();
+
+  void backgroundCompaction();
+
+  double compactionScore(uint32_t layer);
+
+  std::optional<CompactionTask> pickCompaction();
+
+  bool overlapsRunningCompaction(uint32_t outputLayer, K minKey, K maxKey);
 
-  void mergeLayer(uint32_t curLayer);
+  void mergeLayer(const CompactionTask &task,
+                  std::vector<SummaryOfSSTable<K>> &outputs);
 
-  void writeSSTToNextLayer(uint32_t curLayer, uint64_t timeStamp);
+  void writeSSTToNextLayer(const CompactionTask &task,
+                           SSTableBuilder<K, V> &builder,
+                           std::vector<SummaryOfSSTable<K>> &outputs);
 
-  void mergeAllFiles(const std::vector<LayerSerial> &inputFiles,
-                     std::list<std::tuple<uint32_t, uint64_t, K, V>> &out);
+  void installCompaction(const CompactionTask &task,
+                         std::vector<SummaryOfSSTable<K>> &outputs);
 
   std::tuple<K, K, uint64_t>
   scanLayerSSTByOffset(uint32_t curLayer, uint64_t offset,
                        std::vector<LayerSerial> &out);
 
-  uint64_t SSTNeedMergedNextLayer(uint32_t curLayer, K curLayerMinKey,
-                                  K curLayerMaxKey,
-                                  std::vector<LayerSerial> &out);
+  bool SSTNeedMergedNextLayer(uint32_t curLayer, K curLayerMinKey,
+                              K curLayerMaxKey, std::vector<LayerSerial> &out,
+                              uint64_t &maxTimestamp);
 
   void init();
 
   void readWAL();
 
-  void writeWAL(K key, const V &value);
+  std::shared_lock<std::shared_mutex> lockForWrite(size_t writeSize);
 
-  void clearWAL();
+  void writeWAL(const WriteBatch<K> &batch, bool sync,
+                const std::function<void()> &apply);
+
+  void newWAL();
+
+  void clearWAL(uint64_t logNumber);
+
+  std::string genWALName(uint64_t logNumber);
 
   uint64_t loadSSTToCache(uint32_t layerTh, const std::string &sstName);
 
@@ -73,22 +238,57 @@ private:
 
   uint64_t MaxSSTFileNumberInLayer(uint32_t layer);
 
-  bool layerSSTExceedLimit(uint32_t layer);
+  double bloomBitsPerKey(uint32_t layer);
 
 private:
-  SkipList<K, V> memTable;   // LSM的内存层
-  SkipList<K, V> mergeTable; // for merge
-  std::array<Cache<K>, LSM_MAX_LAYER> diskTableCache =
-      {};                    // 磁盘文件的k-v's offset
+  Options options_;
+  std::shared_ptr<SkipList<K, V>> memTable; // LSM的内存层
+  std::deque<ImmutableMemTable> immTables;  // 等待flush, 越靠后越新
+  uint64_t logNumber_ = 0;                  // memTable对应的WAL编号
+  std::unique_ptr<WALWriter> wal_;          // 写入logNumber_对应的WAL
+  std::array<Cache<K>, LSM_MAX_LAYER>
+      diskTableCache;        // 磁盘文件的k-v's offset, 每层一个
   std::string diskDir;       // 磁盘文件根目录
   std::array<uint64_t, LSM_MAX_LAYER> availableNum =
       {};                    // 每一层下一个可用编号, init=0
   uint32_t depthOfLayer = 0; // LSM层数, 以0开始计算
   uint64_t curTimeStamp = 0; // 每生成一个sst都增加curTimeStamp
+
+  std::shared_mutex mutex_; // 保护memTable的切换和磁盘层的元数据
+
+  std::condition_variable_any flushCond_; // 有新的immutable memtable
+  std::condition_variable_any stallCond_; // immutable memtable被flush
+  bool stopFlush_ = false;
+  std::thread flushThread_;
+
+  std::condition_variable_any compactionCond_; // 可能有新的compaction任务
+  bool stopCompaction_ = false;
+  std::set<LayerSerial> compactingFiles_;       // 正在被合并的文件
+  std::list<CompactionTask> runningCompactions_;
+  std::vector<std::thread> compactionThreads_;
+
+  std::unique_ptr<BlockCache> blockCache_; // 所有sst共享, 可能为空
+  TableCache<K> tableCache_;               // 已经打开的sst
 };
 
 template <typename K, typename V>
-KVStore<K, V>::KVStore(std::string dataDirectory) : diskDir(dataDirectory) {
+KVStore<K, V>::KVStore(std::string dataDirectory, Options options)
+    : options_(options), memTable(std::make_shared<SkipList<K, V>>()),
+      diskDir(dataDirectory),
+      blockCache_(options.blockCacheCapacity > 0
+                      ? std::make_unique<BlockCache>(options.blockCacheCapacity)
+                      : nullptr),
+      tableCache_(
+          options.maxOpenFiles,
+          [this](uint32_t layer, uint64_t serialNum) {
+            return genLayerDir(layer) + genSSTNameBySerialNum(serialNum);
+          },
+          blockCache_.get()) {
+  // 只有level-0的文件之间可能重叠
+  for (uint32_t i = 0; i < LSM_MAX_LAYER; ++i) {
+    diskTableCache[i] = Cache<K>(i == 0, options_.learnedIndexError);
+  }
+
   if (!fs::exists(diskDir)) {
     fs::create_directory(diskDir);
   }
@@ -108,67 +308,229 @@ KVStore<K, V>::KVStore(std::string dataDirectory) : diskDir(dataDirectory) {
 }
 
 template <typename K, typename V> KVStore<K, V>::~KVStore() {
-  if (memTable.nodeNum() > 0) {
-    SSTable<K, V> ss(memTable);
-    uint32_t curLayer = 0;
-    auto dirPath = genLayerDir(curLayer);
-    auto sstName = genSSTNameByLayer(curLayer);
-    if (!fs::exists(dirPath)) {
-      fs::create_directory(dirPath);
-    }
-    fmt::print(
-        "minKey = {}, maxKey = {}, kvPairNum = {}, lenOfAllValues = {}\n",
-        ss.minKey, ss.maxKey, ss.kvPairNum, ss.lenOfAllValues);
-    fmt::print("============>ss.writeToFile({}, {})\n", dirPath + sstName,
-               curTimeStamp);
-    // 写入cache
-    diskTableCache[curLayer].insert(ss, curLayer, availableNum[curLayer],
-                                    curTimeStamp);
-    ss.writeToFile(dirPath + sstName, curTimeStamp);
-    ++availableNum[curLayer];
-    ++curTimeStamp;
-    compaction();
-
-    memTable.clear();
-    clearWAL();
+  // 先等后台线程把所有immutable memtable写完
+  {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    stopFlush_ = true;
+  }
+  flushCond_.notify_all();
+  if (flushThread_.joinable()) {
+    flushThread_.join();
+  }
+
+  {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (memTable->nodeNum() > 0) {
+      std::vector<SummaryOfSSTable<K>> outputs;
+      // 已经持有独占锁, 直接分配编号
+      writeLevel0(
+          memTable, bloomBitsPerKey(0),
+          [this]() {
+            return std::pair<uint64_t, uint64_t>{availableNum[0]++,
+                                                 curTimeStamp++};
+          },
+          outputs);
+      for (auto &summary : outputs) {
+        fmt::print("============>flush memTable to level-0 sst_{}.sst, "
+                   "minKey = {}, maxKey = {}, kvPairNum = {}\n",
+                   summary.serialNum, summary.minKey, summary.maxKey,
+                   summary.kvPairNum);
+        diskTableCache[0].insert(std::move(summary));
+      }
+      memTable->clear();
+    }
+    wal_.reset();
+    clearWAL(logNumber_);
+    // 正在运行的compaction会完成并生效, 剩下的留给下一次打开
+    stopCompaction_ = true;
+  }
+  compactionCond_.notify_all();
+  for (auto &th : compactionThreads_) {
+    th.join();
   }
 }
 
 template <typename K, typename V> void KVStore<K, V>::init() {
   readSSTDataToCache();
+  // 重放WAL时也可能产生immutable memtable, 需要先启动后台线程
+  flushThread_ = std::thread([this]() { backgroundFlush(); });
+  size_t threadNum =
+      options_.compactionThreads > 0 ? options_.compactionThreads : 1;
+  for (size_t i = 0; i < threadNum; ++i) {
+    compactionThreads_.emplace_back([this]() { backgroundCompaction(); });
+  }
+  maybeScheduleCompaction();
   readWAL();
 }
 
-template <typename K, typename V> bool KVStore<K, V>::put(K key, V value) {
-  if (memTable.getMemSize() + sizeof(K) + value.size() < MEM_LIMIT) {
-    writeWAL(key, value);
-    return memTable.insert(std::move(key), std::move(value));
+template <typename K, typename V>
+bool KVStore<K, V>::put(K key, V value, const WriteOptions &writeOptions) {
+  if (value.size() > MAX_VALUE_SIZE) {
+    return false;
+  }
+  // WAL记录与只有一个put的write相同
+  WriteBatch<K> batch;
+  batch.put(key, value);
+  auto lock = lockForWrite(batch.byteSize());
+  bool inserted = false;
+  std::function<void()> apply = [&]() {
+    inserted = memTable->insert(std::move(key), std::move(value));
+  };
+  if (writeOptions.disableWAL) {
+    apply();
   } else {
-    const uint32_t layer = 0; // 表示正在操作第layer层的sst
-    // todo: sue SummaryOfSSTable接口?, 然后后续允许修改SSTable
-    SSTable<K, V> sst(memTable);
-    diskTableCache[layer].insert(sst, layer, availableNum[layer], curTimeStamp);
-    std::string layerPath = genLayerDir(layer);
-    std::string sstName = genSSTNameByLayer(layer);
-    if (!fs::exists(layerPath)) {
-      fs::create_directory(layerPath);
-    }
-    sst.writeToFile(layerPath + sstName, curTimeStamp);
-    ++availableNum[layer];
-    ++curTimeStamp; // 用于表示sst的顺序
+    writeWAL(batch, writeOptions.sync, apply);
+  }
+  return inserted;
+}
 
-    compaction();
+template <typename K, typename V>
+void KVStore<K, V>::write(const WriteBatch<K> &batch,
+                          const WriteOptions &writeOptions) {
+  static_assert(std::is_same_v<V, std::string>, "todo: support V != std::string");
+  if (batch.count() == 0) {
+    return;
+  }
+  // 整个batch写入同一个memTable, 与WAL记录对应
+  auto lock = lockForWrite(batch.byteSize());
+  std::function<void()> apply = [this, &batch]() {
+    using EntryType = typename WriteBatch<K>::EntryType;
+    batch.forEach([this](const K &key, EntryType type, std::string_view value) {
+      memTable->insert(key, type == EntryType::Del ? V("~DELETED~") : V(value));
+    });
+  };
+  if (writeOptions.disableWAL) {
+    apply();
+  } else {
+    writeWAL(batch, writeOptions.sync, apply);
+  }
+}
 
-    memTable.clear();
+// 返回mutex_的共享锁, 保证memTable有writeSize的空间.
+// 大部分情况下只需要共享锁, 多个写线程并发插入memTable
+template <typename K, typename V>
+std::shared_lock<std::shared_mutex>
+KVStore<K, V>::lockForWrite(size_t writeSize) {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  while (memTable->getMemSize() + writeSize >= MEM_LIMIT &&
+         memTable->nodeNum() > 0) {
+    lock.unlock();
+    makeRoomForWrite(writeSize);
+    lock.lock();
+  }
+  return lock;
+}
+
+/**
+ * memTable写满时把它切换为immutable memtable, 交给后台线程flush;
+ * 只在以下情况阻塞:
+ * + 等待flush的数量达到options_.maxImmutableMemTables
+ * + level-0的文件数达到options_.level0StopWritesTrigger, 等待compaction
+ */
+template <typename K, typename V>
+void KVStore<K, V>::makeRoomForWrite(size_t writeSize) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  // 拿到独占锁之前可能已经有其它线程完成了切换
+  while (memTable->getMemSize() + writeSize >= MEM_LIMIT &&
+         memTable->nodeNum() > 0) {
+    if (immTables.size() >= options_.maxImmutableMemTables ||
+        diskTableCache[0].size() >= options_.level0StopWritesTrigger) {
+      stallCond_.wait(lock);
+      continue;
+    }
+    immTables.push_back({memTable, logNumber_});
+    memTable = std::make_shared<SkipList<K, V>>();
+    // 旧的WAL在flush之前仍然需要, syncWAL只能看到当前的WAL, 切换前先落盘
+    wal_->sync();
+    ++logNumber_;
+    newWAL();
+    flushCond_.notify_one();
+  }
+}
+
+template <typename K, typename V> void KVStore<K, V>::backgroundFlush() {
+  const uint32_t layer = 0; // 表示正在操作第layer层的sst
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  while (true) {
+    flushCond_.wait(lock, [this]() { return stopFlush_ || !immTables.empty(); });
+    if (immTables.empty()) {
+      break; // 已经stop并且没有待flush的memtable
+    }
+    ImmutableMemTable imm = immTables.front();
+    double bitsPerKey = bloomBitsPerKey(layer);
+    lock.unlock();
+
+    // immutable memtable只读, 构建和写sst时不需要持锁, get仍然可以搜索它
+    std::vector<SummaryOfSSTable<K>> outputs;
+    writeLevel0(
+        imm.table, bitsPerKey,
+        [this]() {
+          std::unique_lock<std::shared_mutex> fileLock(mutex_);
+          // timeStamp用于表示sst的顺序
+          return std::pair<uint64_t, uint64_t>{availableNum[layer]++,
+                                               curTimeStamp++};
+        },
+        outputs);
+
+    lock.lock();
+    // 同一把锁内完成"加入level-0"和"移出immTables", 读线程总能看到这份数据
+    for (auto &summary : outputs) {
+      diskTableCache[layer].insert(std::move(summary));
+    }
+    immTables.pop_front();
+    clearWAL(imm.logNumber);
+    maybeScheduleCompaction();
+    stallCond_.notify_all();
+  }
+}
 
-    clearWAL();
-    writeWAL(key, value);
-    return memTable.insert(std::move(key), std::move(value));
+/**
+ * 把memtable写成一个或多个level-0的sst, 与compaction相同:
+ * 超过MEM_LIMIT或者index block写满时切换到新文件, 一次写入的大batch
+ * 不会产生超出index block容量的sst. 同一个memtable的文件之间不重叠.
+ * nextFile()返回新文件的(serialNum, timeStamp)
+ */
+template <typename K, typename V>
+template <typename NextFile>
+void KVStore<K, V>::writeLevel0(const std::shared_ptr<SkipList<K, V>> &table,
+                                double bitsPerKey, NextFile &&nextFile,
+                                std::vector<SummaryOfSSTable<K>> &outputs) {
+  const uint32_t layer = 0;
+  std::string layerPath = genLayerDir(layer);
+  if (!fs::exists(layerPath)) {
+    fs::create_directory(layerPath);
+  }
+  SSTableBuilder<K, V> builder(options_.compressionForLevel(layer), bitsPerKey,
+                               options_.filterType);
+  auto finishFile = [&]() {
+    auto [serialNum, timeStamp] = nextFile();
+    builder.finish(layerPath + genSSTNameBySerialNum(serialNum), timeStamp);
+    outputs.emplace_back(builder, layer, serialNum, timeStamp);
+    builder.clear();
+  };
+  SkipListIterator<K, V> iter(table);
+  for (iter.seekToFirst(); iter.valid(); iter.next()) {
+    K key = iter.key();
+    std::string_view val = iter.value();
+    if (!builder.empty() &&
+        (builder.estimatedSize() + sizeof(key) + val.size() >= MEM_LIMIT ||
+         builder.full())) {
+      finishFile();
+    }
+    builder.add(key, val);
+  }
+  if (!builder.empty()) {
+    finishFile();
   }
 }
 
 template <typename K, typename V> std::pair<bool, V> KVStore<K, V>::get(K key) {
-  auto [hasKey, value] = memTable.search(key);
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto [hasKey, value] = memTable->search(key);
+  // 从新到旧搜索immutable memtable
+  for (auto it = immTables.rbegin(); !hasKey && it != immTables.rend(); ++it) {
+    std::tie(hasKey, value) = it->table->search(key);
+  }
   if constexpr (std::is_same_v<V, std::string>) {
     if (hasKey) {
       if (value == std::string("~DELETED~")) {
@@ -180,32 +542,29 @@ template <typename K, typename V> std::pair<bool, V> KVStore<K, V>::get(K key) {
     }
 
     // 内存表中不存在,需要从sst中搜索
-    uint32_t layer;
-    uint64_t serialNum;
-    uint64_t offset;
-    for (uint32_t i = 0; i <= depthOfLayer; ++i) {
-      std::tie(layer, serialNum, offset) = diskTableCache[i].search(key);
-      fmt::print("line: {}, layer = {}, serialNum = {}, offset = {}\n",
-                 __LINE__, layer, serialNum, offset);
-      if (layer != LSM_MAX_LAYER + 1) {
-        break;
-      }
+    uint64_t hash = keyHash(key); // 所有层所有sst的过滤器共用
+    std::shared_ptr<SSTableReader<K>> reader; // value可能指向reader的映射
+    std::string_view sstValue;
+    BlockPin pin;
+    auto probe = [&](uint32_t layer, uint64_t serialNum, BlockHandle block) {
+      // 过滤器假阳性时block中没有key, 继续查找更旧的文件
+      reader = tableCache_.get(layer, serialNum);
+      return reader->getInBlock(block, key, sstValue, pin);
+    };
+    bool found = false;
+    for (uint32_t i = 0; !found && i <= depthOfLayer; ++i) {
+      found = diskTableCache[i].search(key, hash, probe);
     }
 
     // 不存在该key
-    if (layer == LSM_MAX_LAYER + 1) {
+    if (!found) {
       fmt::print("line: {}, {}, {}, get({}) == false\n", __LINE__, __FUNCTION__,
                  __LINE__, key);
       return {false, V{}};
     }
 
-    fmt::print("line: {}, layer = {}, serialNum = {}, offset = {}\n", __LINE__,
-               layer, serialNum, offset);
-    auto sstFilename = genLayerDir(layer) + genSSTNameBySerialNum(serialNum);
-    std::string value = readSSTableFromFile<K>(sstFilename, offset);
-
-    if (value != std::string("~DELETED~")) {
-      return {true, value};
+    if (sstValue != std::string_view("~DELETED~")) {
+      return {true, V(sstValue)};
     } else {
       fmt::print("{}, {}, get({}) == false\n", __FUNCTION__, __LINE__, key);
       return {false, V{}};
@@ -217,7 +576,168 @@ template <typename K, typename V> std::pair<bool, V> KVStore<K, V>::get(K key) {
   }
 }
 
-template <typename K, typename V> bool KVStore<K, V>::del(K key) {
+/**
+ * key排序去重后:
+ * + 按key的顺序查找memtable和immutable memtable
+ * + 剩余的key每个只计算一次hash, 逐层查找
+ * + 每层先由fence pointer找出每个key可能所在的文件和data block, 再按文件
+ *   分组, 同一个文件的key一起交给SSTableReader::multiGet,
+ *   落在同一个block的key共用一次读取
+ * + 过滤器假阳性时, key在下一轮中查找更旧的候选文件
+ */
+template <typename K, typename V>
+std::vector<std::pair<bool, V>>
+KVStore<K, V>::multiGet(std::span<const K> keys) {
+  std::vector<std::pair<bool, V>> results(keys.size(), {false, V{}});
+  if constexpr (!std::is_same_v<V, std::string>) {
+    fmt::print("todo: support V != std::string\n");
+    return results;
+  } else {
+    std::vector<size_t> order(keys.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&keys](size_t l, size_t r) { return keys[l] < keys[r]; });
+    std::vector<K> sortedKeys; // 去重后的key, 升序
+    for (auto i : order) {
+      if (sortedKeys.empty() || sortedKeys.back() != keys[i]) {
+        sortedKeys.push_back(keys[i]);
+      }
+    }
+
+    // resolved[i]: sortedKeys[i]已经找到最新的版本(可能是墓碑)
+    std::vector<bool> resolved(sortedKeys.size(), false);
+    std::vector<std::optional<V>> values(sortedKeys.size());
+    auto resolve = [&](size_t i, std::string_view value) {
+      resolved[i] = true;
+      if (value != std::string_view("~DELETED~")) {
+        values[i] = V(value);
+      }
+    };
+
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < sortedKeys.size(); ++i) {
+      auto [hasKey, value] = memTable->search(sortedKeys[i]);
+      for (auto it = immTables.rbegin(); !hasKey && it != immTables.rend();
+           ++it) {
+        std::tie(hasKey, value) = it->table->search(sortedKeys[i]);
+      }
+      if (hasKey) {
+        resolve(i, value);
+      } else {
+        pending.push_back(i);
+      }
+    }
+
+    std::vector<uint64_t> hashes(sortedKeys.size());
+    for (auto i : pending) {
+      hashes[i] = keyHash(sortedKeys[i]);
+    }
+
+    std::vector<K> groupKeys;
+    std::vector<BlockHandle> groupBlocks;
+    for (uint32_t layer = 0; !pending.empty() && layer <= depthOfLayer;
+         ++layer) {
+      // 每个key在这一层的候选文件以及所在的data block, 从新到旧
+      std::vector<std::vector<std::pair<LayerSerial, BlockHandle>>> candidates(
+          pending.size());
+      for (size_t p = 0; p < pending.size(); ++p) {
+        size_t i = pending[p];
+        diskTableCache[layer].search(
+            sortedKeys[i], hashes[i],
+            [&](uint32_t fileLayer, uint64_t serialNum, BlockHandle block) {
+              candidates[p].push_back({{fileLayer, serialNum}, block});
+              return false;
+            });
+      }
+
+      // 第round轮查找每个key的第round个候选文件
+      for (size_t round = 0;; ++round) {
+        std::map<LayerSerial, std::vector<size_t>> groups; // 文件 -> pending下标
+        for (size_t p = 0; p < pending.size(); ++p) {
+          if (!resolved[pending[p]] && round < candidates[p].size()) {
+            // pending有序, 组内也有序
+            groups[candidates[p][round].first].push_back(p);
+          }
+        }
+        if (groups.empty()) {
+          break;
+        }
+        for (auto &[file, members] : groups) {
+          groupKeys.clear();
+          groupBlocks.clear();
+          for (auto p : members) {
+            groupKeys.push_back(sortedKeys[pending[p]]);
+            groupBlocks.push_back(candidates[p][round].second);
+          }
+          auto reader = tableCache_.get(file.first, file.second);
+          reader->multiGet(std::span<const K>(groupKeys),
+                           std::span<const BlockHandle>(groupBlocks),
+                           [&](size_t j, std::string_view value) {
+                             resolve(pending[members[j]], value);
+                           });
+        }
+      }
+      std::erase_if(pending, [&resolved](size_t i) { return resolved[i]; });
+    }
+
+    for (auto i : order) {
+      auto pos = static_cast<size_t>(
+          std::lower_bound(sortedKeys.begin(), sortedKeys.end(), keys[i]) -
+          sortedKeys.begin());
+      if (values[pos].has_value()) {
+        results[i] = {true, *values[pos]};
+      }
+    }
+    return results;
+  }
+}
+
+template <typename K, typename V>
+std::unique_ptr<Iterator<K>> KVStore<K, V>::newIterator() {
+  static_assert(std::is_same_v<V, std::string>, "todo: support V != std::string");
+  std::vector<std::unique_ptr<Iterator<K>>> children;
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  // 从新到旧: memTable, immutable memtable, level-0(新到旧), 更深的层
+  children.emplace_back(std::make_unique<SkipListIterator<K, V>>(memTable));
+  for (auto it = immTables.rbegin(); it != immTables.rend(); ++it) {
+    children.emplace_back(std::make_unique<SkipListIterator<K, V>>(it->table));
+  }
+  for (auto &summary : diskTableCache[0]) {
+    children.emplace_back(std::make_unique<SSTableIterator<K>>(
+        tableCache_.get(summary.layer, summary.serialNum)));
+  }
+  for (uint32_t layer = 1; layer <= depthOfLayer; ++layer) {
+    // 先打开reader, 文件之后被compaction删除时映射仍然有效
+    std::vector<K> maxKeys;
+    std::vector<std::shared_ptr<SSTableReader<K>>> readers;
+    for (auto &summary : diskTableCache[layer]) {
+      maxKeys.push_back(summary.maxKey);
+      readers.push_back(tableCache_.get(summary.layer, summary.serialNum));
+    }
+    children.emplace_back(std::make_unique<ConcatIterator<K>>(
+        std::move(maxKeys),
+        [readers = std::move(readers)](size_t i)
+            -> std::unique_ptr<Iterator<K>> {
+          return std::make_unique<SSTableIterator<K>>(readers[i]);
+        }));
+  }
+  return std::make_unique<KVStoreIterator<K>>(
+      std::make_unique<MergingIterator<K>>(std::move(children)));
+}
+
+template <typename K, typename V>
+std::vector<std::pair<K, V>> KVStore<K, V>::scan(K start, K end) {
+  std::vector<std::pair<K, V>> result;
+  auto iter = newIterator();
+  for (iter->seek(start); iter->valid() && !(end < iter->key()); iter->next()) {
+    result.emplace_back(iter->key(), V(iter->value()));
+  }
+  return result;
+}
+
+template <typename K, typename V>
+bool KVStore<K, V>::del(K key, const WriteOptions &writeOptions) {
   auto [ret, value] = get(key);
   if (ret == false) {
     return false; // key不存在
@@ -226,8 +746,8 @@ template <typename K, typename V> bool KVStore<K, V>::del(K key) {
     if (value == std::string("~DELETED~")) {
       return true;
     }
-    memTable.remove(key);
-    put(key, std::string("~DELETED~"));
+    // 墓碑直接覆盖memTable中的旧值, 不需要先remove
+    put(key, std::string("~DELETED~"), writeOptions);
     return true;
   } else {
     fmt::print("todo: support V != std::string\n");
@@ -235,123 +755,228 @@ template <typename K, typename V> bool KVStore<K, V>::del(K key) {
   }
 }
 
-template <typename K, typename V> void KVStore<K, V>::compaction() {
-  uint32_t curLayer = 0;
-  while (layerSSTExceedLimit(curLayer)) {
-    mergeLayer(curLayer);
-    ++curLayer;
+template <typename K, typename V>
+void KVStore<K, V>::maybeScheduleCompaction() {
+  compactionCond_.notify_all();
+}
+
+/**
+ * compaction线程: 持有mutex_挑选任务, 合并和写文件时不持锁,
+ * 最后再持锁把结果一次性生效
+ */
+template <typename K, typename V> void KVStore<K, V>::backgroundCompaction() {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  while (true) {
+    std::optional<CompactionTask> task;
+    compactionCond_.wait(lock, [this, &task]() {
+      if (stopCompaction_) {
+        return true;
+      }
+      task = pickCompaction();
+      return task.has_value();
+    });
+    if (!task.has_value()) {
+      break;
+    }
+    lock.unlock();
+
+    std::vector<SummaryOfSSTable<K>> outputs;
+    mergeLayer(*task, outputs);
+
+    lock.lock();
+    installCompaction(*task, outputs);
+    // 生效之后其它层可能超出上限, 之前冲突的任务也可能可以运行了
+    compactionCond_.notify_all();
+    stallCond_.notify_all();
   }
 }
 
+// 文件数 / 该层上限, 大于1说明需要compaction
 template <typename K, typename V>
-void KVStore<K, V>::mergeLayer(uint32_t curLayer) {
-  std::vector<LayerSerial> mergeFiles; // 使用层数+顺序号表示sst文件
-  uint64_t curLayerNeedScanStart = 0;
-  if (curLayer > 0) {
-    curLayerNeedScanStart = MaxSSTFileNumberInLayer(curLayer);
-  }
-
-  auto [minKey, maxKey, curMaxTimestamp] =
-      scanLayerSSTByOffset(curLayer, curLayerNeedScanStart, mergeFiles);
-  auto eraseIt = diskTableCache[curLayer].begin();
-  std::advance(eraseIt, curLayerNeedScanStart);
-  diskTableCache[curLayer].cacheOfLayer.erase(eraseIt,
-                                              diskTableCache[curLayer].end());
-
-  auto tmpMaxTimestamp =
-      SSTNeedMergedNextLayer(curLayer, minKey, maxKey, mergeFiles);
-
-  curMaxTimestamp =
-      curMaxTimestamp > tmpMaxTimestamp ? curMaxTimestamp : tmpMaxTimestamp;
-
-  std::list<std::tuple<uint32_t, uint64_t, K, V>> resultOfMerge;
-  mergeAllFiles(mergeFiles, resultOfMerge);
-
-  mergeTable.clear();
-  auto prevKey = std::numeric_limits<K>::max();
-
-  bool curLayerIsBottom = curLayer == depthOfLayer;
-  for (auto &[layer_, serialNum_, key, val] : resultOfMerge) {
-    // 只保留最新的key
-    if (key != prevKey) {
-      if constexpr (std::is_same_v<V, std::string>) {
-        if (curLayerIsBottom && val == std::string("~DELETED~")) {
-          prevKey = key;
-          continue;
-        }
-      } else {
-        static_assert(true, "todo: support V != std::string\n");
-        std::cout << "typeId(V) = " << typeid(V).name() << '\n';
-      }
+double KVStore<K, V>::compactionScore(uint32_t layer) {
+  return static_cast<double>(diskTableCache[layer].size()) /
+         static_cast<double>(MaxSSTFileNumberInLayer(layer));
+}
 
-      if (mergeTable.getMemSize() + sizeof(key) + val.size() < MEM_LIMIT) {
-        mergeTable.insert(key, val);
-        prevKey = key;
-      } else {
-        writeSSTToNextLayer(curLayer, curMaxTimestamp);
-        mergeTable.insert(key, val); // 别忘了插入数据
-        prevKey = key;
-      }
+/**
+ * 按score从高到低挑选一个可以运行的任务(调用方持有mutex_的独占锁).
+ * 和正在运行的任务不冲突才可以并行:
+ * + 输入文件都没有在被合并
+ * + 输出到同一层的key范围不重叠
+ */
+template <typename K, typename V>
+std::optional<typename KVStore<K, V>::CompactionTask>
+KVStore<K, V>::pickCompaction() {
+  std::vector<std::pair<double, uint32_t>> candidates;
+  for (uint32_t i = 0; i <= depthOfLayer && i + 1 < LSM_MAX_LAYER; ++i) {
+    double score = compactionScore(i);
+    if (score > 1.0) {
+      candidates.emplace_back(score, i);
     }
   }
+  std::sort(candidates.begin(), candidates.end(),
+            [](auto &&left, auto &&right) { return left.first > right.first; });
+
+  for (auto &[score, curLayer] : candidates) {
+    CompactionTask task;
+    task.layer = curLayer;
+    uint64_t curLayerNeedScanStart = 0;
+    if (curLayer > 0) {
+      curLayerNeedScanStart = MaxSSTFileNumberInLayer(curLayer);
+    }
+    std::tie(task.minKey, task.maxKey, task.maxTimestamp) =
+        scanLayerSSTByOffset(curLayer, curLayerNeedScanStart, task.inputs);
+    if (task.inputs.empty()) {
+      continue; // 超出上限的文件都在被合并
+    }
 
-  if (mergeTable.nodeNum() > 0) {
-    writeSSTToNextLayer(curLayer, curMaxTimestamp);
+    uint64_t nextMaxTimestamp = 0;
+    if (!SSTNeedMergedNextLayer(curLayer, task.minKey, task.maxKey,
+                                task.inputs, nextMaxTimestamp)) {
+      continue; // 下一层重叠的文件正在被合并
+    }
+    if (overlapsRunningCompaction(curLayer + 1, task.minKey, task.maxKey)) {
+      continue;
+    }
+    task.maxTimestamp = task.maxTimestamp > nextMaxTimestamp
+                            ? task.maxTimestamp
+                            : nextMaxTimestamp;
+    task.isBottom = curLayer == depthOfLayer;
+
+    for (auto &file : task.inputs) {
+      compactingFiles_.insert(file);
+    }
+    runningCompactions_.push_back(task);
+    return task;
   }
+  return std::nullopt;
+}
 
-  for (auto &file : mergeFiles) {
-    fs::remove(genLayerDir(file.first) + genSSTNameBySerialNum(file.second));
+template <typename K, typename V>
+bool KVStore<K, V>::overlapsRunningCompaction(uint32_t outputLayer, K minKey,
+                                              K maxKey) {
+  for (auto &running : runningCompactions_) {
+    if (running.layer + 1 != outputLayer) {
+      continue;
+    }
+    if (!(maxKey < running.minKey || running.maxKey < minKey)) {
+      return true;
+    }
   }
+  return false;
 }
 
+// 不持锁: 输入文件已经被标记为正在合并, 不会被删除
 template <typename K, typename V>
-void KVStore<K, V>::writeSSTToNextLayer(uint32_t curLayer, uint64_t timeStamp) {
-  uint32_t nextLayer = curLayer == LSM_MAX_LAYER ? LSM_MAX_LAYER : curLayer + 1;
-  SSTable<K, V> sst(mergeTable);
-  diskTableCache[nextLayer].insert(sst, nextLayer, availableNum[nextLayer],
-                                   timeStamp);
+void KVStore<K, V>::mergeLayer(const CompactionTask &task,
+                               std::vector<SummaryOfSSTable<K>> &outputs) {
+  // 越新的文件越靠前: 层数小的更新, 同一层中编号大的更新
+  auto inputs = task.inputs;
+  std::sort(inputs.begin(), inputs.end(), [](auto &&left, auto &&right) {
+    if (left.first != right.first) {
+      return left.first < right.first;
+    }
+    return left.second > right.second;
+  });
+  std::vector<std::unique_ptr<Iterator<K>>> children;
+  for (auto &file : inputs) {
+    children.emplace_back(std::make_unique<SSTableIterator<K>>(
+        tableCache_.get(file.first, file.second)));
+  }
+  MergingIterator<K> iter(std::move(children));
+
+  double bitsPerKey;
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    bitsPerKey = bloomBitsPerKey(task.layer + 1);
+  }
+  SSTableBuilder<K, V> builder(options_.compressionForLevel(task.layer + 1),
+                               bitsPerKey, options_.filterType);
+  bool hasPrevKey = false;
+  K prevKey{};
+  for (iter.seekToFirst(); iter.valid(); iter.next()) {
+    K key = iter.key();
+    // 相同的key最先出现的是最新的版本, 其余的丢弃
+    if (hasPrevKey && key == prevKey) {
+      continue;
+    }
+    hasPrevKey = true;
+    prevKey = key;
+
+    std::string_view val = iter.value();
+    if constexpr (std::is_same_v<V, std::string>) {
+      if (task.isBottom && val == std::string_view("~DELETED~")) {
+        continue;
+      }
+    } else {
+      static_assert(true, "todo: support V != std::string\n");
+      std::cout << "typeId(V) = " << typeid(V).name() << '\n';
+    }
+
+    if (!builder.empty() &&
+        (builder.estimatedSize() + sizeof(key) + val.size() >= MEM_LIMIT ||
+         builder.full())) {
+      writeSSTToNextLayer(task, builder, outputs);
+    }
+    builder.add(key, val);
+  }
+
+  if (!builder.empty()) {
+    writeSSTToNextLayer(task, builder, outputs);
+  }
+}
+
+template <typename K, typename V>
+void KVStore<K, V>::writeSSTToNextLayer(
+    const CompactionTask &task, SSTableBuilder<K, V> &builder,
+    std::vector<SummaryOfSSTable<K>> &outputs) {
+  uint32_t nextLayer = task.layer + 1;
+  uint64_t serialNum;
+  {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    serialNum = availableNum[nextLayer]++;
+  }
   auto levelDir = genLayerDir(nextLayer);
-  auto sstName = genSSTNameByLayer(nextLayer);
   if (!fs::exists(levelDir)) {
     fs::create_directory(levelDir);
-    depthOfLayer = nextLayer; // 更新当前LSM的最大深度.
   }
-  sst.writeToFile(levelDir + sstName, curTimeStamp);
-  ++availableNum[nextLayer];
-  mergeTable.clear();
+  builder.finish(levelDir + genSSTNameBySerialNum(serialNum),
+                 task.maxTimestamp);
+  outputs.emplace_back(builder, nextLayer, serialNum, task.maxTimestamp);
+  builder.clear();
 }
 
+// 调用方持有mutex_的独占锁: 删除输入, 加入输出, 然后删除输入文件
 template <typename K, typename V>
-void KVStore<K, V>::mergeAllFiles(
-    const std::vector<LayerSerial> &inputFiles,
-    std::list<std::tuple<uint32_t, uint64_t, K, V>> &out) {
-  for (auto &file : inputFiles) {
-    auto tmp = filterSSTableFromFile<K, V>(
-        file.first, file.second,
-        genLayerDir(file.first) + genSSTNameBySerialNum(file.second));
-    out.merge(tmp, [](auto &&left, auto &&right) {
-      auto LLayer = std::get<0>(left);
-      auto LSerialNum = std::get<1>(left);
-      auto LKey = std::get<2>(left);
-      auto LValue = std::get<3>(left);
-
-      auto RLayer = std::get<0>(right);
-      auto RSerialNum = std::get<1>(right);
-      auto RKey = std::get<2>(right);
-      auto RValue = std::get<3>(right);
-
-      if (LKey == RKey) {
-        if (LLayer < RLayer) {
-          return true;
-        } else if (LLayer > RLayer) {
-          return false;
-        } else {
-          return LSerialNum > RSerialNum;
-        }
-      } else {
-        return LKey < RKey;
-      }
-    });
+void KVStore<K, V>::installCompaction(
+    const CompactionTask &task, std::vector<SummaryOfSSTable<K>> &outputs) {
+  uint32_t nextLayer = task.layer + 1;
+  auto isInput = [&task](const SummaryOfSSTable<K> &summary) {
+    return std::find(task.inputs.begin(), task.inputs.end(),
+                     LayerSerial{summary.layer, summary.serialNum}) !=
+           task.inputs.end();
+  };
+  diskTableCache[task.layer].removeIf(isInput);
+  diskTableCache[nextLayer].removeIf(isInput);
+  for (auto &summary : outputs) {
+    diskTableCache[nextLayer].insert(std::move(summary));
+  }
+  if (!outputs.empty() && nextLayer > depthOfLayer) {
+    depthOfLayer = nextLayer; // 更新当前LSM的最大深度.
+  }
+
+  for (auto &file : task.inputs) {
+    compactingFiles_.erase(file);
+    // 正在使用的reader仍然持有映射, 文件删除后映射依然有效
+    tableCache_.evict(file.first, file.second);
+    fs::remove(genLayerDir(file.first) + genSSTNameBySerialNum(file.second));
+  }
+  for (auto it = runningCompactions_.begin(); it != runningCompactions_.end();
+       ++it) {
+    if (it->layer == task.layer && it->inputs == task.inputs) {
+      runningCompactions_.erase(it);
+      break;
+    }
   }
 }
 
@@ -368,6 +993,9 @@ KVStore<K, V>::scanLayerSSTByOffset(uint32_t curLayer, uint64_t offset,
 
   for (; it != diskTableCache[curLayer].end(); ++it) {
     assert(it->layer == curLayer);
+    if (compactingFiles_.count({it->layer, it->serialNum}) > 0) {
+      continue;
+    }
     out.emplace_back(it->layer, it->serialNum);
     maxTimestamp = maxTimestamp > it->timeStamp ? maxTimestamp : it->timeStamp;
     minKey = minKey < it->minKey ? minKey : it->minKey;
@@ -376,83 +1004,110 @@ KVStore<K, V>::scanLayerSSTByOffset(uint32_t curLayer, uint64_t offset,
   return {minKey, maxKey, maxTimestamp};
 }
 
+// 找到下一层与[curLayerMinKey, curLayerMaxKey]重叠的文件,
+// 如果其中有正在被合并的文件则返回false
 template <typename K, typename V>
-uint64_t KVStore<K, V>::SSTNeedMergedNextLayer(uint32_t curLayer,
-                                               K curLayerMinKey,
-                                               K curLayerMaxKey,
-                                               std::vector<LayerSerial> &out) {
-  uint64_t maxTimestamp = 0;
-  if (curLayer == LSM_MAX_LAYER) {
-    return maxTimestamp;
+bool KVStore<K, V>::SSTNeedMergedNextLayer(uint32_t curLayer, K curLayerMinKey,
+                                           K curLayerMaxKey,
+                                           std::vector<LayerSerial> &out,
+                                           uint64_t &maxTimestamp) {
+  maxTimestamp = 0;
+  if (curLayer + 1 >= LSM_MAX_LAYER) {
+    return true;
   }
   uint32_t nextLayer = curLayer + 1;
 
   auto it = diskTableCache[nextLayer].begin();
-  for (; it != diskTableCache[nextLayer].end();) {
+  for (; it != diskTableCache[nextLayer].end(); ++it) {
     K minK = it->minKey;
     K maxK = it->maxKey;
     if (curLayerMaxKey < minK || maxK < curLayerMinKey) {
-      ++it;
       continue; // 无交集
     }
     assert(it->layer == nextLayer);
+    if (compactingFiles_.count({it->layer, it->serialNum}) > 0) {
+      return false;
+    }
     out.emplace_back(it->layer, it->serialNum);
     maxTimestamp = maxTimestamp > it->timeStamp ? maxTimestamp : it->timeStamp;
-    it = diskTableCache[nextLayer].cacheOfLayer.erase(it);
   }
 
-  return maxTimestamp;
+  return true;
 }
 
 template <typename K, typename V> void KVStore<K, V>::readWAL() {
   assert(diskDir.size() > 0);
-  auto walLogPath = diskDir + std::string("log/wal.log");
-  if (fs::exists(walLogPath)) {
-    std::ifstream in(walLogPath, std::ios::in);
-    assert(in.is_open());
-    K key;
-    uint64_t valueLen;
-    while (!in.eof()) {
-      in.read(reinterpret_cast<char *>(&key), sizeof(key));
-      in.read(reinterpret_cast<char *>(&valueLen), sizeof(valueLen));
-      std::string buf;
-      buf.resize(valueLen);
-      in.read(buf.data(), valueLen);
-      if constexpr (std::is_same_v<std::string, V>) {
-        put(key, std::move(buf));
-      } else {
-        // todo: std::string convert to V
-        V *ptr = reinterpret_cast<V *>(buf.data);
-        V value = *ptr; // 多了一次拷贝
-        put(key, std::move(value));
-      }
+  std::vector<uint64_t> logNumbers;
+  for (auto &&iter : fs::directory_iterator(diskDir + std::string("log/"))) {
+    auto name = iter.path().filename().string();
+    // wal_{logNumber}.log
+    if (name.rfind("wal_", 0) != 0 || iter.path().extension() != ".log") {
+      continue;
     }
-
-    in.close();
-    clearWAL();
+    uint64_t num = 0;
+    std::from_chars(name.data() + 4, name.data() + name.size() - 4, num);
+    logNumbers.emplace_back(num);
+  }
+  std::sort(logNumbers.begin(), logNumbers.end());
+  if (!logNumbers.empty()) {
+    // 重放的数据写入新的WAL, 旧的WAL重放完再删除
+    logNumber_ = logNumbers.back() + 1;
+  }
+  newWAL();
+
+  for (auto logNumber : logNumbers) {
+    auto walLogPath = genWALName(logNumber);
+    WALReader reader(walLogPath);
+    std::string record;
+    WriteBatch<K> batch;
+    // 在第一条损坏的记录处停止, 之后的记录不再可信
+    while (reader.readRecord(record) && batch.decodeFrom(record)) {
+      // 重放完一个文件再统一落盘
+      write(batch, WriteOptions{.sync = false});
+    }
+    if (reader.corrupted()) {
+      fmt::print("{}: {} is corrupted, stop replaying\n", __FUNCTION__,
+                 walLogPath);
+    }
+    wal_->sync();
+    clearWAL(logNumber);
   }
 }
 
+// 每条WAL记录是一个编码后的WriteBatch
 template <typename K, typename V>
-void KVStore<K, V>::writeWAL(K key, const V &value) {
-  assert(diskDir.size() > 0);
-  auto logDir = diskDir + std::string("log/");
-  if (!fs::exists(logDir)) {
-    fs::create_directory(logDir);
-  }
-  auto logFileName = std::string("wal.log");
-  std::ofstream out(logDir + logFileName,
-                    std::ios::out | std::ios::app | std::ios::binary);
-  uint64_t valueLen = value.size();
-  out.write(reinterpret_cast<char *>(&key), sizeof(key));
-  out.write(reinterpret_cast<char *>(&valueLen), sizeof(valueLen));
-  out.write(reinterpret_cast<const char *>(&value), sizeof(V));
-  out.close();
+void KVStore<K, V>::writeWAL(const WriteBatch<K> &batch, bool sync,
+                             const std::function<void()> &apply) {
+  // 调用方持有mutex_, wal_不会被切换.
+  // memTable由group commit的leader按WAL的顺序插入, 并发写同一个key时
+  // 读到的版本与重放WAL得到的版本相同
+  wal_->addRecord(batch.data(), sync, apply);
 }
 
-template <typename K, typename V> void KVStore<K, V>::clearWAL() {
-  auto walLogPath = diskDir + std::string("log/wal.log");
-  fs::remove(walLogPath);
+template <typename K, typename V> void KVStore<K, V>::flushWAL() {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  wal_->flush();
+}
+
+template <typename K, typename V> void KVStore<K, V>::syncWAL() {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  wal_->sync();
+}
+
+// 调用方持有mutex_的独占锁(或在init中)
+template <typename K, typename V> void KVStore<K, V>::newWAL() {
+  wal_ = std::make_unique<WALWriter>(genWALName(logNumber_));
+}
+
+template <typename K, typename V>
+void KVStore<K, V>::clearWAL(uint64_t logNumber) {
+  fs::remove(genWALName(logNumber));
+}
+
+template <typename K, typename V>
+std::string KVStore<K, V>::genWALName(uint64_t logNumber) {
+  return diskDir + std::string("log/wal_") + std::to_string(logNumber) +
+         std::string(".log");
 }
 
 template <typename K, typename V>
@@ -465,10 +1120,10 @@ uint64_t KVStore<K, V>::loadSSTToCache(uint32_t layerTh,
     std::abort();
   }
   SummaryOfSSTable<K> summary;
-  readSummaryOfSSTableFromFile<K>(sstPath, summary);
-  fmt::print("{}: readSummaryOfSSTableFromFile {}\n", __FUNCTION__, sstPath);
   summary.layer = layerTh;
   summary.serialNum = getNumBySSTFilename(sstName);
+  readSummaryOfSSTable(*tableCache_.get(layerTh, summary.serialNum), summary);
+  fmt::print("{}: readSummaryOfSSTable {}\n", __FUNCTION__, sstPath);
   uint64_t timeStamp = summary.timeStamp;
   fmt::print("summary: layer = {}, serialNum = {},timeStamp = {},minKey = "
              "{},maxKey = {}, kvPairNum = {}\n",
@@ -502,8 +1157,8 @@ template <typename K, typename V> void KVStore<K, V>::readSSTDataToCache() {
       // ...
     }
 
-    std::sort(allSSTSerialNum.begin(), allSSTSerialNum.end(),
-              std::greater<uint64_t>{});
+    // 编号从小到大加载, insert()总是插入到最前面, 保证最新的文件在前
+    std::sort(allSSTSerialNum.begin(), allSSTSerialNum.end());
     // load sst to cache
     for (const auto &sstSerialNum : allSSTSerialNum) {
       auto sstName = genSSTNameBySerialNum(sstSerialNum);
@@ -512,7 +1167,7 @@ template <typename K, typename V> void KVStore<K, V>::readSSTDataToCache() {
       curTimeStamp = curTimeStamp > timeStamp ? curTimeStamp : timeStamp;
     }
     if (!allSSTSerialNum.empty()) {
-      availableNum[i] = allSSTSerialNum.front() + 1;
+      availableNum[i] = allSSTSerialNum.back() + 1;
     }
     fmt::print("==========>availableNum[{}] = {}\n", i, availableNum[i]);
   }
@@ -550,9 +1205,16 @@ uint64_t KVStore<K, V>::MaxSSTFileNumberInLayer(uint32_t layer) {
   return 2 << layer;
 }
 
+// 调用方持有mutex_: 新生成的layer层sst的布隆过滤器使用的bits/key
 template <typename K, typename V>
-bool KVStore<K, V>::layerSSTExceedLimit(uint32_t layer) {
-  fmt::print("diskTableCache[{}].size() = {}\n", layer,
-             diskTableCache[layer].size());
-  return diskTableCache[layer].size() > MaxSSTFileNumberInLayer(layer);
-}
\ No newline at end of file
+double KVStore<K, V>::bloomBitsPerKey(uint32_t layer) {
+  if (!options_.bloomPerLevelAllocation) {
+    return options_.bloomBitsPerKey;
+  }
+  // 每层写满时的文件数之比近似为各层的key数之比
+  std::vector<double> keysPerLevel;
+  for (uint32_t i = 0; i <= std::max(depthOfLayer, layer); ++i) {
+    keysPerLevel.push_back(static_cast<double>(MaxSSTFileNumberInLayer(i)));
+  }
+  return monkeyBitsPerKey(options_.bloomBitsPerKey, keysPerLevel)[layer];
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "MurmurHash3.h"
+
+#include <cstdint>
+#include <type_traits>
+
+// MurmurHash3的fmix64: 64位到64位的双射, 每个输入bit都影响全部输出bit
+inline uint64_t fmix64(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/**
+ * key的64位hash, 写sst时构建过滤器和查询时使用同一个函数:
+ * + get对每个key只计算一次, 所有层所有sst的过滤器都由这个hash派生
+ * + 不超过64位的整数key在编译期选择fmix64, 只需要两次乘法
+ * + 其它类型按字节计算MurmurHash3_x64_128, 取前64位
+ * 修改实现会使已有sst的过滤器失效
+ */
+template <typename K> inline uint64_t keyHash(const K &key) {
+  if constexpr (std::is_integral_v<K> && sizeof(K) <= sizeof(uint64_t)) {
+    using U = std::make_unsigned_t<K>;
+    // 加上常数避免key为0时hash为0
+    return fmix64(static_cast<uint64_t>(static_cast<U>(key)) +
+                  0x9e3779b97f4a7c15ULL);
+  } else {
+    uint64_t hash[2] = {0};
+    MurmurHash3_x64_128(&key, sizeof(key), 1, hash);
+    return hash[0];
+  }
+}
@@ -0,0 +1,292 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TINYKV_KEYINDEX_AVX2 1
+#endif
+
+/**
+ * 有序key -> offset的内存索引(例如sst的fence pointer), key和offset分开存放(SoA):
+ * + keys_按key有序, 每LEAF_KEYS个key为一个叶子, 64位key时一个叶子恰好一条cache line
+ * + 每个叶子的最大key按Eytzinger(BFS)顺序存放在top_中, 查找时从根向下走,
+ *   访问的位置集中在数组开头, 并且可以提前预取后面几层
+ * + 定位到叶子后用SIMD一次比较整个叶子, 得到叶子内第一个>=key的位置
+ * offsets_只在找到key之后访问一次, 不占用查找路径上的cache
+ *
+ * 可选的学习索引(train): 分段线性模型预测key的位置, 误差不超过maxError,
+ * 查找只在预测位置附近的窗口内二分, 并释放top_. key近似均匀分布时只需要
+ * 一两个分段, 比top_小得多
+ */
+template <typename K> class KeyIndex {
+  static_assert(std::is_integral_v<K>, "目前只支持整数类型的key");
+
+public:
+  static constexpr size_t LEAF_KEYS = 8;
+
+  KeyIndex() {}
+
+  // keys严格递增, 与offsets一一对应
+  KeyIndex(std::vector<K> keys, std::vector<uint64_t> offsets)
+      : size_(keys.size()), keys_(std::move(keys)),
+        offsets_(std::move(offsets)) {
+    assert(keys_.size() == offsets_.size());
+    assert(std::is_sorted(keys_.begin(), keys_.end()));
+    buildTop();
+  }
+
+  explicit KeyIndex(const std::vector<std::pair<K, uint64_t>> &keyOffset)
+      : size_(keyOffset.size()) {
+    keys_.reserve(keyOffset.size());
+    offsets_.reserve(keyOffset.size());
+    for (auto &[key, offset] : keyOffset) {
+      keys_.push_back(key);
+      offsets_.push_back(offset);
+    }
+    buildTop();
+  }
+
+  size_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  K key(size_t i) const {
+    assert(i < size_);
+    return keys_[i];
+  }
+
+  uint64_t offset(size_t i) const {
+    assert(i < size_);
+    return offsets_[i];
+  }
+
+  // 用分段线性模型代替top_, maxError为0时恢复为Eytzinger查找
+  void train(size_t maxError) {
+    segments_.clear();
+    maxError_ = maxError;
+    if (maxError == 0) {
+      buildTop();
+      return;
+    }
+    // 贪心的收缩锥: 当前分段所有点的预测误差都不超过maxError时,
+    // 斜率必须落在[slopeLo, slopeHi]内, 区间为空时开始新的分段
+    size_t start = 0;
+    double slopeLo = 0;
+    double slopeHi = std::numeric_limits<double>::infinity();
+    auto flush = [&]() {
+      double slope = std::isinf(slopeHi) ? 0 : (slopeLo + slopeHi) / 2;
+      segments_.push_back({keys_[start], start, slope});
+    };
+    for (size_t i = 1; i < size_; ++i) {
+      double dx = distance(keys_[start], keys_[i]);
+      double dy = static_cast<double>(i - start);
+      double lo = std::max(slopeLo, (dy - double(maxError)) / dx);
+      double hi = std::min(slopeHi, (dy + double(maxError)) / dx);
+      if (lo > hi) {
+        flush();
+        start = i;
+        slopeLo = 0;
+        slopeHi = std::numeric_limits<double>::infinity();
+        continue;
+      }
+      slopeLo = lo;
+      slopeHi = hi;
+    }
+    if (size_ > 0) {
+      flush();
+    }
+    top_.assign(1, K{});
+    top_.shrink_to_fit();
+    topLeaf_.assign(1, 0);
+    topLeaf_.shrink_to_fit();
+  }
+
+  bool learned() const { return maxError_ > 0; }
+
+  size_t segments() const { return segments_.size(); }
+
+  // 查找结构(不含keys_和offsets_)占用的字节数
+  size_t indexMemoryUsage() const {
+    return top_.capacity() * sizeof(K) + topLeaf_.capacity() * sizeof(uint32_t) +
+           segments_.capacity() * sizeof(Segment);
+  }
+
+  // 第一个>= key的位置, 不存在时返回size()
+  size_t lowerBound(K key) const {
+    if (learned()) {
+      return lowerBoundLearned(key);
+    }
+    size_t leaves = top_.size() - 1;
+    size_t k = 1;
+    while (k <= leaves) {
+      // 预取k往下第log2(PREFETCH_STRIDE)层的节点, 它们在同一条cache line中
+      __builtin_prefetch(top_.data() + k * PREFETCH_STRIDE);
+      k = 2 * k + (top_[k] < key);
+    }
+    // 去掉最后连续向右走的步数, 得到最后一次向左走的节点
+    k >>= __builtin_ffsll(static_cast<long long>(~k));
+    if (k == 0) {
+      return size_;
+    }
+    size_t leaf = topLeaf_[k];
+    size_t pos = leaf * LEAF_KEYS + countLess(keys_.data() + leaf * LEAF_KEYS, key);
+    return pos < size_ ? pos : size_;
+  }
+
+  std::optional<uint64_t> find(K key) const {
+    size_t pos = lowerBound(key);
+    if (pos < size_ && keys_[pos] == key) {
+      return offsets_[pos];
+    }
+    return std::nullopt;
+  }
+
+  friend bool operator==(const KeyIndex &x, const KeyIndex &y) {
+    return x.size_ == y.size_ && x.keys_ == y.keys_ && x.offsets_ == y.offsets_;
+  }
+
+private:
+  static constexpr size_t PREFETCH_STRIDE = 64 / sizeof(K);
+
+  struct Segment {
+    K firstKey;
+    size_t firstPos;
+    double slope; // 每增加1个key值, 位置增加slope
+  };
+
+  // b - a, 要求a <= b; 有符号key按无符号计算避免溢出
+  static double distance(K a, K b) {
+    using U = std::make_unsigned_t<K>;
+    return static_cast<double>(static_cast<U>(static_cast<U>(b) -
+                                              static_cast<U>(a)));
+  }
+
+  size_t lowerBoundLearned(K key) const {
+    if (size_ == 0 || key <= keys_[0]) {
+      return 0;
+    }
+    // 最后一个firstKey <= key的分段
+    auto seg = std::upper_bound(
+        segments_.begin(), segments_.end(), key,
+        [](K value, const Segment &right) { return value < right.firstKey; });
+    --seg;
+    double predicted = static_cast<double>(seg->firstPos) +
+                       seg->slope * distance(seg->firstKey, key);
+    // 查询的key不一定在索引中, 窗口两侧各多留一个位置
+    double window = static_cast<double>(maxError_ + 1);
+    size_t lo = predicted - window <= 0
+                    ? 0
+                    : static_cast<size_t>(predicted - window);
+    size_t hi = predicted + window + 1 >= double(size_)
+                    ? size_
+                    : static_cast<size_t>(predicted + window + 1);
+    lo = std::min(lo, size_);
+    auto begin = keys_.begin();
+    size_t pos = static_cast<size_t>(
+        std::lower_bound(begin + static_cast<std::ptrdiff_t>(lo),
+                         begin + static_cast<std::ptrdiff_t>(hi), key) -
+        begin);
+    // 结果落在窗口边界上时确认窗口外没有更合适的位置, 否则整体二分
+    bool valid = (pos > lo || lo == 0 || keys_[lo - 1] < key) &&
+                 (pos < hi || hi == size_ || !(keys_[hi] < key));
+    if (!valid) {
+      pos = static_cast<size_t>(
+          std::lower_bound(begin, begin + static_cast<std::ptrdiff_t>(size_),
+                           key) -
+          begin);
+    }
+    return pos;
+  }
+
+  void buildTop() {
+    // 最后一个叶子用最大值补齐, 补齐的key不会被计入countLess
+    keys_.resize((size_ + LEAF_KEYS - 1) / LEAF_KEYS * LEAF_KEYS,
+                 std::numeric_limits<K>::max());
+    size_t leaves = keys_.size() / LEAF_KEYS;
+    top_.assign(leaves + 1, K{});
+    topLeaf_.assign(leaves + 1, 0);
+    size_t leaf = 0;
+    fillTop(1, leaf);
+    assert(leaf == leaves);
+  }
+
+  // 中序遍历Eytzinger树, 依次填入每个叶子的最大key
+  void fillTop(size_t k, size_t &leaf) {
+    if (k >= top_.size()) {
+      return;
+    }
+    fillTop(2 * k, leaf);
+    top_[k] = keys_[leaf * LEAF_KEYS + LEAF_KEYS - 1];
+    topLeaf_[k] = static_cast<uint32_t>(leaf);
+    ++leaf;
+    fillTop(2 * k + 1, leaf);
+  }
+
+  static size_t countLessScalar(const K *leaf, K key) {
+    size_t count = 0;
+    for (size_t i = 0; i < LEAF_KEYS; ++i) {
+      count += leaf[i] < key;
+    }
+    return count;
+  }
+
+#ifdef TINYKV_KEYINDEX_AVX2
+  __attribute__((target("avx2"))) static size_t countLessAVX2(const K *leaf,
+                                                              K key) {
+    // 只有有符号的64位比较, 无符号key翻转符号位后比较结果不变
+    constexpr uint64_t flip =
+        std::is_signed_v<K> ? 0 : uint64_t(1) << 63;
+    __m256i bias = _mm256_set1_epi64x(static_cast<long long>(flip));
+    __m256i target = _mm256_xor_si256(
+        _mm256_set1_epi64x(static_cast<long long>(key)), bias);
+    __m256i lo = _mm256_xor_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(leaf)), bias);
+    __m256i hi = _mm256_xor_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(leaf + 4)), bias);
+    int mask = _mm256_movemask_pd(_mm256_castsi256_pd(
+                   _mm256_cmpgt_epi64(target, lo))) |
+               (_mm256_movemask_pd(_mm256_castsi256_pd(
+                    _mm256_cmpgt_epi64(target, hi)))
+                << 4);
+    return static_cast<size_t>(__builtin_popcount(static_cast<unsigned>(mask)));
+  }
+
+  static bool hasAVX2() {
+    static const bool supported = [] {
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2") != 0;
+    }();
+    return supported;
+  }
+#endif
+
+  static size_t countLess(const K *leaf, K key) {
+#ifdef TINYKV_KEYINDEX_AVX2
+    if constexpr (sizeof(K) == sizeof(uint64_t)) {
+      if (hasAVX2()) {
+        return countLessAVX2(leaf, key);
+      }
+    }
+#endif
+    return countLessScalar(leaf, key);
+  }
+
+private:
+  size_t size_ = 0;               // key数, 不含补齐的部分
+  std::vector<K> keys_;           // 有序, 长度补齐到LEAF_KEYS的倍数
+  std::vector<uint64_t> offsets_; // 与keys_一一对应
+  std::vector<K> top_{K{}};       // 每个叶子的最大key, Eytzinger顺序, 下标从1开始
+  std::vector<uint32_t> topLeaf_{0}; // top_中每个节点对应的叶子编号
+  size_t maxError_ = 0;              // 0表示没有学习索引
+  std::vector<Segment> segments_;    // 按firstKey有序
+};
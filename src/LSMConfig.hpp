@@ -2,6 +2,10 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <vector>
+
+#include "Compression.hpp"
+#include "Filter.hpp"
 
 constexpr bool isPowerOf2(size_t N) {
   size_t n = 1;
@@ -14,9 +18,61 @@ constexpr bool isPowerOf2(size_t N) {
 constexpr uint32_t LSM_MAX_LAYER = 16; // LSM最大深度
 constexpr uint32_t KB = 1024;
 constexpr uint32_t MB = 1024 * 1024;
-inline constexpr size_t BLOOM_SIZE = 8 * KB; // 布隆过滤器大小
+inline constexpr double BLOOM_BITS_PER_KEY = 10; // 布隆过滤器每个key的bit数
 //inline constexpr size_t MEM_LIMIT = MB;      // 内存限制
 
 inline constexpr size_t MEM_LIMIT = 16 * KB;      // 内存限制
+inline constexpr uint16_t SST_BLOCK_SIZE = 4 * KB; // sst中data block的大小
+// value的最大长度: block的entry中v_len只有2B, 更长的value在写入时被拒绝
+inline constexpr size_t MAX_VALUE_SIZE = UINT16_MAX;
+
+// KVStore的运行时配置
+struct Options {
+  // 等待后台flush的immutable memtable上限, 达到上限后写线程阻塞
+  size_t maxImmutableMemTables = 2;
+  // 后台compaction线程数, 互不重叠的compaction可以并行
+  size_t compactionThreads = 2;
+  // level-0的文件数达到该值时写线程阻塞, 等待compaction
+  size_t level0StopWritesTrigger = 12;
+  // TableCache中最多同时打开的sst数量
+  size_t maxOpenFiles = 1000;
+  // 所有sst共享的block cache的字节数, 0表示不使用block cache
+  size_t blockCacheCapacity = 8 * MB;
+  // 布隆过滤器的大小按sst中的key数计算
+  double bloomBitsPerKey = BLOOM_BITS_PER_KEY;
+  // 为true时在总内存不变的前提下按层分配bits/key(见monkeyBitsPerKey),
+  // 上层分到更多, 最底层分到更少
+  bool bloomPerLevelAllocation = false;
+  // 新生成的sst使用的过滤器. Xor的大小固定, 不受上面两项影响(为0时除外);
+  // 读取时按sst中记录的类型查询, 修改后新旧sst可以共存
+  FilterType filterType = FilterType::Bloom;
+  // 大于0时为每个sst的内存索引训练分段线性模型, 预测位置的最大误差.
+  // 只在模型预测的窗口内查找, 并且不再保存Eytzinger索引
+  size_t learnedIndexError = 0;
+  // sst中block的压缩方式
+  CompressionType compression = CompressionType::LZ;
+  // 非空时按层覆盖compression, 超出部分沿用最后一项.
+  // 例如{NoCompression, NoCompression, LZ}: 0/1层不压缩, 更深的层用LZ
+  std::vector<CompressionType> compressionPerLevel;
+
+  CompressionType compressionForLevel(uint32_t level) const {
+    if (compressionPerLevel.empty()) {
+      return compression;
+    }
+    if (level >= compressionPerLevel.size()) {
+      return compressionPerLevel.back();
+    }
+    return compressionPerLevel[level];
+  }
+};
 
-static_assert(isPowerOf2(BLOOM_SIZE), "BLOOM_SIZE must be power of 2");
\ No newline at end of file
+/**
+ * 单次写入(put/del)的持久化方式:
+ * + sync: 返回前WAL已经fdatasync, 机器掉电也不会丢失
+ * + !sync: WAL写入OS的page cache后返回, 进程崩溃不会丢失, 掉电可能丢失
+ * + disableWAL: 只写memTable, flush成sst之前崩溃会丢失, 用于可以重建的数据
+ */
+struct WriteOptions {
+  bool sync = true;
+  bool disableWAL = false;
+};
\ No newline at end of file
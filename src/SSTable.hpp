@@ -2,43 +2,345 @@
 
 #include <fmt/core.h>
 
-#include <bitset>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <array>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
+#include <limits>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <span>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <type_traits>
 #include <vector>
 
+#include "Block.hpp"
+#include "BlockCache.hpp"
+#include "Compression.hpp"
+#include "Filter.hpp"
+#include "Iterator.hpp"
+#include "KeyIndex.hpp"
 #include "LSMConfig.hpp"
-#include "MurmurHash3.h"
 #include "SkipList.hpp"
 
+/**
+ * sst文件格式:
+ * | data block 0 | ... | data block n | index block | filter | footer |
+ * + data block: BlockBuilder编码的kv, 写满SST_BLOCK_SIZE后开始下一个block
+ * + data block和index block按block压缩, 末尾追加1B的CompressionType
+ * + index block: 每个data block对应一项, key为该block的最大key,
+ *   value为该block在文件中的offset和size
+ * + filter: 布隆过滤器或xor过滤器, 编码见Filter
+ * + footer: 定长, 位于文件末尾, 记录元数据以及index block和filter的位置
+ * 点查只需要读footer, index block和一个data block, 读取见SSTableReader
+ */
+
+// key按大端序编码, 使block中按字节比较的结果与按数值比较一致
+template <typename K> std::array<uint8_t, sizeof(K)> encodeKey(K key) {
+  static_assert(std::is_integral_v<K>, "目前只支持整数类型的key");
+  using U = std::make_unsigned_t<K>;
+  U bits = static_cast<U>(key);
+  if constexpr (std::is_signed_v<K>) {
+    bits ^= static_cast<U>(U(1) << (sizeof(K) * 8 - 1)); // 负数排在前面
+  }
+  std::array<uint8_t, sizeof(K)> buf;
+  for (size_t i = 0; i < sizeof(K); ++i) {
+    buf[i] = static_cast<uint8_t>(bits >> (8 * (sizeof(K) - 1 - i)));
+  }
+  return buf;
+}
+
+template <typename K> K decodeKey(std::span<const uint8_t> buf) {
+  static_assert(std::is_integral_v<K>, "目前只支持整数类型的key");
+  using U = std::make_unsigned_t<K>;
+  assert(buf.size() == sizeof(K));
+  U bits = 0;
+  for (size_t i = 0; i < sizeof(K); ++i) {
+    bits = static_cast<U>((bits << 8) | buf[i]);
+  }
+  if constexpr (std::is_signed_v<K>) {
+    bits ^= static_cast<U>(U(1) << (sizeof(K) * 8 - 1));
+  }
+  return static_cast<K>(bits);
+}
+
+// 一段连续的文件区域
+struct BlockHandle {
+  uint64_t offset = 0;
+  uint64_t size = 0;
+
+  friend bool operator==(const BlockHandle &, const BlockHandle &) = default;
+};
+
+template <typename K> struct SSTableFooter {
+  uint64_t timeStamp = 0;
+  uint64_t lenOfAllValues = 0;
+  K minKey{};
+  K maxKey{};
+  uint64_t kvPairNum = 0;
+  BlockHandle index;
+  BlockHandle filter;
+
+  static constexpr uint64_t MAGIC = 0x54696e794b565353; // "TinyKVSS"
+  static constexpr size_t ENCODED_SIZE = 8 * sizeof(uint64_t) + 2 * sizeof(K);
+
+  void encodeTo(std::vector<uint8_t> &buf) const {
+    put_u64(buf, timeStamp);
+    put_u64(buf, lenOfAllValues);
+    const uint8_t *minPtr = reinterpret_cast<const uint8_t *>(&minKey);
+    const uint8_t *maxPtr = reinterpret_cast<const uint8_t *>(&maxKey);
+    buf.insert(buf.end(), minPtr, minPtr + sizeof(K));
+    buf.insert(buf.end(), maxPtr, maxPtr + sizeof(K));
+    put_u64(buf, kvPairNum);
+    put_u64(buf, index.offset);
+    put_u64(buf, index.size);
+    put_u64(buf, filter.offset);
+    put_u64(buf, filter.size);
+    put_u64(buf, MAGIC);
+  }
+
+  // magic不匹配时返回false
+  bool decodeFrom(const uint8_t *ptr) {
+    timeStamp = get_u64(ptr);
+    ptr += sizeof(uint64_t);
+    lenOfAllValues = get_u64(ptr);
+    ptr += sizeof(uint64_t);
+    ::memcpy(&minKey, ptr, sizeof(K));
+    ptr += sizeof(K);
+    ::memcpy(&maxKey, ptr, sizeof(K));
+    ptr += sizeof(K);
+    kvPairNum = get_u64(ptr);
+    ptr += sizeof(uint64_t);
+    index.offset = get_u64(ptr);
+    ptr += sizeof(uint64_t);
+    index.size = get_u64(ptr);
+    ptr += sizeof(uint64_t);
+    filter.offset = get_u64(ptr);
+    ptr += sizeof(uint64_t);
+    filter.size = get_u64(ptr);
+    ptr += sizeof(uint64_t);
+    return get_u64(ptr) == MAGIC;
+  }
+};
+
+// 压缩block并追加type, 返回的handle包含末尾的type
+inline BlockHandle appendBlock(std::vector<uint8_t> &file,
+                               std::span<const uint8_t> contents,
+                               CompressionType type) {
+  BlockHandle handle{file.size(), 0};
+  auto actual = compressBlock(type, contents, file);
+  file.push_back(static_cast<uint8_t>(actual));
+  handle.size = file.size() - handle.offset;
+  return handle;
+}
+
+// index block项的value: data block的offset和size
+inline BlockHandle decodeBlockHandle(std::span<const uint8_t> value) {
+  assert(value.size() == 2 * sizeof(uint64_t));
+  return {get_u64(value.data()), get_u64(value.data() + sizeof(uint64_t))};
+}
+
+/**
+ * 流式构建sst: 按key从小到大add, finish时写入文件.
+ * 只缓存一个sst的数据, compaction的内存占用与输入的总大小无关
+ */
+template <typename K, typename V> struct SSTableBuilder {
+  K minKey = std::numeric_limits<K>::max(); // 当前segment的最小key
+  K maxKey = std::numeric_limits<K>::min(); // 当前segment的最大key
+  uint64_t kvPairNum = 0;                   // kv对的数量
+  uint64_t lenOfAllValues = 0;              // 所有value长度之和
+  std::vector<std::pair<K, uint64_t>> keyOffset; // key和所在data block的offset
+  Filter filter; // 过滤器, 在buildFilter之后有效
+  uint64_t dataSize = 0; // 所有data block的总大小, 在finishData之后有效
+
+  // bitsPerKey <= 0时不生成过滤器
+  explicit SSTableBuilder(CompressionType compression = CompressionType::LZ,
+                          double bitsPerKey = BLOOM_BITS_PER_KEY,
+                          FilterType filterType = FilterType::Bloom)
+      : blockBuilder_(SST_BLOCK_SIZE), compression_(compression),
+        bitsPerKey_(bitsPerKey), filterType_(filterType) {}
+
+  // index block最多容纳的data block数: 每项为entry头(6B) + restart(2B) +
+  // key + BlockHandle(16B), block的offset和大小都只有2B
+  static constexpr size_t MAX_INDEX_ENTRIES =
+      (UINT16_MAX - sizeof(uint16_t)) / (8 + sizeof(K) + 2 * sizeof(uint64_t));
+
+  // 要求key严格递增, value不超过MAX_VALUE_SIZE
+  void add(const K &key, std::string_view value) {
+    assert(kvPairNum == 0 || maxKey < key);
+    if (value.size() > MAX_VALUE_SIZE) {
+      fmt::print("{}: value size {} exceeds {}\n", __FUNCTION__, value.size(),
+                 MAX_VALUE_SIZE);
+      std::abort();
+    }
+    auto encoded = encodeKey(key);
+    std::span<const uint8_t> valueSpan(
+        reinterpret_cast<const uint8_t *>(value.data()), value.size());
+    if (!blockBuilder_.add(encoded, valueSpan)) {
+      flushBlock();
+      [[maybe_unused]] bool ok = blockBuilder_.add(encoded, valueSpan);
+      assert(ok == true);
+    }
+
+    if (kvPairNum == 0) {
+      minKey = key;
+    }
+    maxKey = key;
+    keyOffset.emplace_back(key, blocks_.size()); // 当前block写在已有block之后
+    lenOfAllValues += value.size();
+    ++kvPairNum;
+
+    keyHashes_.push_back(keyHash(key));
+  }
+
+  // 与SkipList::getMemSize()的统计方式一致
+  uint64_t estimatedSize() { return kvPairNum * sizeof(K) + lenOfAllValues; }
+
+  bool empty() { return kvPairNum == 0; }
+
+  // index block已满, 调用方需要先finish, 再把后面的key写入新的sst.
+  // 每次add之后检查, add最多开始一个新的data block
+  bool full() {
+    return indexEntries_.size() + (blockBuilder_.empty() ? 0 : 1) >=
+           MAX_INDEX_ENTRIES;
+  }
+
+  // 写出最后一个data block, 之后不能再add
+  void finishData() {
+    flushBlock();
+    dataSize = blocks_.size();
+  }
+
+  // 按key数和bitsPerKey生成过滤器
+  void buildFilter() {
+    filter = Filter::build(filterType_, bitsPerKey_, keyHashes_);
+  }
+
+  void finish(const std::string &filename, uint64_t timeStamp);
+
+  void clear() {
+    minKey = std::numeric_limits<K>::max();
+    maxKey = std::numeric_limits<K>::min();
+    kvPairNum = 0;
+    lenOfAllValues = 0;
+    keyOffset.clear();
+    filter = Filter();
+    dataSize = 0;
+    keyHashes_.clear();
+    blockBuilder_.clear();
+    blocks_.clear();
+    indexEntries_.clear();
+  }
+
+private:
+  // 把当前data block追加到blocks_, 并记录它的index项
+  void flushBlock() {
+    if (blockBuilder_.empty()) {
+      return;
+    }
+    auto encoded = blockBuilder_.build().encode();
+    auto handle = appendBlock(blocks_, encoded, compression_);
+    indexEntries_.emplace_back(maxKey, handle);
+    blockBuilder_.clear();
+  }
+
+private:
+  BlockBuilder blockBuilder_;
+  CompressionType compression_;
+  double bitsPerKey_;
+  FilterType filterType_;
+  std::vector<uint64_t> keyHashes_; // finish时才知道key数, 先记录hash
+  std::vector<uint8_t> blocks_; // 已经编码并压缩好的data block
+  std::vector<std::pair<K, BlockHandle>> indexEntries_;
+};
+
+template <typename K, typename V>
+void SSTableBuilder<K, V>::finish(const std::string &filename,
+                                  uint64_t timeStamp) {
+  finishData();
+  buildFilter();
+
+  SSTableFooter<K> footer;
+  footer.timeStamp = timeStamp;
+  footer.lenOfAllValues = lenOfAllValues;
+  footer.minKey = minKey;
+  footer.maxKey = maxKey;
+  footer.kvPairNum = kvPairNum;
+
+  std::vector<uint8_t> meta;
+  if (!indexEntries_.empty()) {
+    BlockBuilder indexBuilder(UINT16_MAX, 1); // 每项都是restart点
+    for (auto &[lastKey, handle] : indexEntries_) {
+      std::vector<uint8_t> handleBuf;
+      put_u64(handleBuf, handle.offset);
+      put_u64(handleBuf, handle.size);
+      if (!indexBuilder.add(encodeKey(lastKey), handleBuf)) {
+        // 调用方没有按full()切分sst
+        fmt::print("{}: {} data blocks exceed the index block of {}\n",
+                   __FUNCTION__, indexEntries_.size(), filename);
+        std::abort();
+      }
+    }
+    footer.index =
+        appendBlock(meta, indexBuilder.build().encode(), compression_);
+    footer.index.offset += blocks_.size();
+  }
+  footer.filter.offset = blocks_.size() + meta.size();
+  size_t filterStart = meta.size();
+  filter.encodeTo(meta);
+  footer.filter.size = meta.size() - filterStart;
+  footer.encodeTo(meta);
+
+  std::fstream out(filename, std::ios::out | std::ios::binary);
+  assert(out.is_open() == true);
+  out.write(reinterpret_cast<const char *>(blocks_.data()),
+            static_cast<std::streamsize>(blocks_.size()));
+  out.write(reinterpret_cast<const char *>(meta.data()),
+            static_cast<std::streamsize>(meta.size()));
+  out.close();
+}
+
 template <typename K, typename V> struct SSTable {
   K minKey = std::numeric_limits<K>::max(); // 当前segment的最小key
   K maxKey = std::numeric_limits<K>::min(); // 当前segment的最大key
   uint64_t kvPairNum = 0;                   // kv对的数量
   uint64_t lenOfAllValues = 0;              // 所有value长度之和
   std::list<std::pair<K, V>> kvdata;        // 在内存中的所有kv
-  std::list<uint64_t> valueOffset;          // value在文件的offset
-  std::bitset<BLOOM_SIZE> bloom;            // 布隆过滤器
-
-  SSTable(SkipList<K, V> &li);
+  std::list<uint64_t> valueOffset;          // value所在data block的offset
+  Filter filter;                            // 过滤器
+  uint64_t dataSize = 0;                    // 所有data block的总大小
+
+  SSTable(SkipList<K, V> &li,
+          CompressionType compression = CompressionType::LZ,
+          double bitsPerKey = BLOOM_BITS_PER_KEY,
+          FilterType filterType = FilterType::Bloom);
   SSTable();
   ~SSTable();
 
   void clear();
   void writeToFile(std::string filename, uint64_t timeStamp);
+
+private:
+  SSTableBuilder<K, V> builder_; // 构造时已经切分好data block
 };
 
 template <typename K, typename V> SSTable<K, V>::SSTable() {}
 
 template <typename K, typename V> SSTable<K, V>::~SSTable() {}
 
-template <typename K, typename V> SSTable<K, V>::SSTable(SkipList<K, V> &li) {
-  assert(bloom.none() == true);
+template <typename K, typename V>
+SSTable<K, V>::SSTable(SkipList<K, V> &li, CompressionType compression,
+                       double bitsPerKey, FilterType filterType)
+    : builder_(compression, bitsPerKey, filterType) {
+  static_assert(std::is_same_v<std::string, V>, "目前只支持V == std::String");
 
   auto [resMin, minK] = li.getMinKey();
   auto [resMax, maxK] = li.getMaxKey();
@@ -50,164 +352,355 @@ template <typename K, typename V> SSTable<K, V>::SSTable(SkipList<K, V> &li) {
   // todo: use scanALL() replace minKey&maxKey
   li.scan(minKey, maxKey, kvdata);
 
-  uint64_t offset = 0;
-  uint32_t hash[4] = {0};
   for (auto &[k, v] : kvdata) {
-    valueOffset.push_back(offset);
-    offset += v.size();
-    lenOfAllValues += v.size();
-    MurmurHash3_x64_128(&k, sizeof(k), 1, hash);
-    for (int i = 0; i < 4; ++i) {
-      bloom[hash[i] % BLOOM_SIZE] = 1;
-    }
+    builder_.add(k, v);
+  }
+  builder_.finishData();
+  for (auto &[k, off] : builder_.keyOffset) {
+    valueOffset.push_back(off);
   }
+  dataSize = builder_.dataSize;
+  lenOfAllValues = builder_.lenOfAllValues;
+  builder_.buildFilter();
+  filter = builder_.filter;
 }
 
 template <typename K, typename V>
 void SSTable<K, V>::writeToFile(std::string filename, uint64_t timeStamp) {
-  std::fstream out(filename, std::ios::out | std::ios::binary);
-  assert(out.is_open() == true);
-  out.write(reinterpret_cast<const char *>(&timeStamp), sizeof(timeStamp));
-  out.write(reinterpret_cast<const char *>(&lenOfAllValues),
-            sizeof(lenOfAllValues));
-  out.write(reinterpret_cast<const char *>(&minKey), sizeof(minKey));
-  out.write(reinterpret_cast<const char *>(&maxKey), sizeof(maxKey));
-  out.write(reinterpret_cast<const char *>(&kvPairNum), sizeof(kvPairNum));
-  out.write(reinterpret_cast<const char *>(&bloom), sizeof(bloom));
-
-  auto it = kvdata.begin();
-  auto it2 = valueOffset.begin();
-  for (; it != kvdata.end(); ++it, ++it2) {
-    out.write(reinterpret_cast<const char *>(&(it->first)), sizeof(it->first));
-    out.write(reinterpret_cast<const char *>(&(*it2)), sizeof(*it2));
-  }
-  for (auto it = kvdata.begin(); it != kvdata.end(); ++it) {
-    if constexpr (std::is_same_v<std::string, V>) {
-      out.write(it->second.c_str(), it->second.size());
-    } else {
-      static_assert(1 == 1, "目前只支持V == std::String");
+  builder_.finish(filename, timeStamp);
+}
+
+// 保证SSTableReader::get返回的value有效: 持有value所在的block
+struct BlockPin {
+  std::vector<uint8_t> scratch;        // 不使用block cache时解压的内容
+  std::shared_ptr<const Block> block; // value所在的block
+};
+
+/**
+ * 只读打开一个sst文件: mmap整个文件并一直保持映射, footer在打开时解析.
+ * 点查由调用方根据SummaryOfSSTable的fence pointer给出data block(getInBlock),
+ * 不需要index block; index block只在迭代器等需要时才解析, 之后一直保留.
+ * 未压缩的block直接在映射上解析, key/value不做复制;
+ * 压缩的block先解压到调用方提供的scratch中.
+ * 指定blockCache时点查的data block经过block cache
+ */
+template <typename K> class SSTableReader {
+public:
+  explicit SSTableReader(const std::string &fileName,
+                         BlockCache *blockCache = nullptr);
+  ~SSTableReader();
+
+  SSTableReader(const SSTableReader &) = delete;
+  SSTableReader &operator=(const SSTableReader &) = delete;
+
+  const SSTableFooter<K> &footer() const { return footer_; }
+
+  std::span<const uint8_t> filter() const { return fileRange(footer_.filter); }
+
+  // 第一次调用时解析index block, 可以被多个线程同时调用
+  const Block &indexBlock() const;
+
+  // block的内容: 未压缩时指向映射, 否则解压到scratch并指向scratch
+  std::span<const uint8_t> readBlock(BlockHandle handle,
+                                     std::vector<uint8_t> &scratch) const;
+
+  // 解析好的data block, 优先从block cache中获取
+  std::shared_ptr<const Block> readDataBlock(BlockHandle handle,
+                                             BlockPin &pin) const;
+
+  // 点查: 找到时value指向pin持有的block, 在pin下一次被使用前有效.
+  // 通过index block定位data block, 已知block时使用getInBlock
+  bool get(K key, std::string_view &value, BlockPin &pin) const;
+
+  // 只在handle指向的data block中查找key, 不读取index block
+  bool getInBlock(BlockHandle handle, K key, std::string_view &value,
+                  BlockPin &pin) const;
+
+  // 批量点查, keys按升序排列, handles[i]为keys[i]所在的data block:
+  // 对找到的key调用fn(keys中的下标, value), value只在fn内有效.
+  // 落在同一个data block的key只读取一次block
+  template <typename Fn>
+  void multiGet(std::span<const K> keys, std::span<const BlockHandle> handles,
+                Fn &&fn) const;
+
+private:
+  std::span<const uint8_t> fileRange(BlockHandle handle) const {
+    assert(handle.offset + handle.size <= size_);
+    return {base_ + handle.offset, handle.size};
+  }
+
+private:
+  const uint8_t *base_ = nullptr;
+  size_t size_ = 0;
+  SSTableFooter<K> footer_;
+  mutable std::once_flag indexOnce_;
+  mutable std::vector<uint8_t> indexScratch_; // 压缩的index block解压后的内容
+  mutable Block index_;
+  BlockCache *blockCache_;
+  uint64_t cacheId_ = 0; // 在blockCache_中区分不同的文件
+};
+
+template <typename K>
+SSTableReader<K>::SSTableReader(const std::string &fileName,
+                                BlockCache *blockCache)
+    : blockCache_(blockCache) {
+  int fd = ::open(fileName.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || ::fstat(fd, &st) != 0) {
+    fmt::print("{}: open {} failed\n", __FUNCTION__, fileName);
+    std::abort();
+  }
+  size_ = static_cast<size_t>(st.st_size);
+  assert(size_ >= SSTableFooter<K>::ENCODED_SIZE);
+  void *addr = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd); // 映射建立之后不再需要fd
+  if (addr == MAP_FAILED) {
+    fmt::print("{}: mmap {} failed\n", __FUNCTION__, fileName);
+    std::abort();
+  }
+  base_ = static_cast<const uint8_t *>(addr);
+
+  [[maybe_unused]] bool ok =
+      footer_.decodeFrom(base_ + size_ - SSTableFooter<K>::ENCODED_SIZE);
+  assert(ok == true);
+  if (blockCache_ != nullptr) {
+    cacheId_ = blockCache_->newId();
+  }
+}
+
+template <typename K> SSTableReader<K>::~SSTableReader() {
+  ::munmap(const_cast<uint8_t *>(base_), size_);
+}
+
+template <typename K> const Block &SSTableReader<K>::indexBlock() const {
+  std::call_once(indexOnce_, [this]() {
+    if (footer_.index.size > 0) {
+      index_.decode_view(readBlock(footer_.index, indexScratch_));
     }
+  });
+  return index_;
+}
+
+template <typename K>
+std::span<const uint8_t>
+SSTableReader<K>::readBlock(BlockHandle handle,
+                            std::vector<uint8_t> &scratch) const {
+  assert(handle.size > 0);
+  auto raw = fileRange(handle);
+  auto type = static_cast<CompressionType>(raw.back());
+  auto contents = raw.first(raw.size() - 1);
+  if (type == CompressionType::NoCompression) {
+    return contents;
   }
+  scratch.clear();
+  [[maybe_unused]] bool ok = uncompressBlock(type, contents, scratch);
+  assert(ok == true);
+  return scratch;
+}
 
-  out.close();
+template <typename K>
+std::shared_ptr<const Block>
+SSTableReader<K>::readDataBlock(BlockHandle handle, BlockPin &pin) const {
+  if (blockCache_ == nullptr) {
+    auto block = std::make_shared<Block>();
+    block->decode_view(readBlock(handle, pin.scratch));
+    return block;
+  }
+  auto block = blockCache_->lookup(cacheId_, handle.offset);
+  if (block == nullptr) {
+    // 缓存中的block不能引用映射, 因为reader可能先于它被关闭
+    auto owned = std::make_shared<Block>();
+    owned->decode(readBlock(handle, pin.scratch));
+    blockCache_->insert(cacheId_, handle.offset, owned);
+    block = std::move(owned);
+  }
+  return block;
 }
 
 template <typename K>
-std::string readSSTableFromFile(std::string fileName, uint64_t offset) {
-  fmt::print("{}: open {}\n", __FUNCTION__, fileName);
-  std::ifstream in(fileName, std::ios::in | std::ios::binary);
-  assert(in.is_open() == true);
-  uint64_t timeStamp_, lenOfAllValues_, minKey_, maxKey_, kvPairNum_;
-  std::bitset<BLOOM_SIZE> bloom_;
-  in.read(reinterpret_cast<char *>(&timeStamp_), sizeof(timeStamp_));
-  in.read(reinterpret_cast<char *>(&lenOfAllValues_), sizeof(lenOfAllValues_));
-  in.read(reinterpret_cast<char *>(&minKey_), sizeof(minKey_));
-  in.read(reinterpret_cast<char *>(&maxKey_), sizeof(maxKey_));
-  in.read(reinterpret_cast<char *>(&kvPairNum_), sizeof(kvPairNum_));
-  in.read(reinterpret_cast<char *>(&bloom_), sizeof(bloom_));
-
-  K key;
-  uint64_t off;
-  uint64_t targetLen;
-
-  uint64_t i = 0;
-  for (; i < kvPairNum_; ++i) {
-    in.read(reinterpret_cast<char *>(&key), sizeof(key));
-    in.read(reinterpret_cast<char *>(&off), sizeof(off));
-    if (offset == off) {
-      break;
+bool SSTableReader<K>::get(K key, std::string_view &value,
+                           BlockPin &pin) const {
+  if (footer_.kvPairNum == 0 || key < footer_.minKey || footer_.maxKey < key) {
+    return false;
+  }
+  // index block中第一个最大key >= key的block是唯一可能包含key的block
+  auto &index = indexBlock();
+  auto indexIt = index.lower_bound(encodeKey(key));
+  if (indexIt == index.end()) {
+    return false;
+  }
+  return getInBlock(decodeBlockHandle(indexIt.value), key, value, pin);
+}
+
+template <typename K>
+bool SSTableReader<K>::getInBlock(BlockHandle handle, K key,
+                                  std::string_view &value,
+                                  BlockPin &pin) const {
+  auto target = encodeKey(key);
+  pin.block = readDataBlock(handle, pin);
+  auto it = pin.block->lower_bound(target);
+  if (it == pin.block->end() || compare_key(it.key, target) != 0) {
+    return false;
+  }
+  value = std::string_view(reinterpret_cast<const char *>(it.value.data()),
+                           it.value.size());
+  return true;
+}
+
+template <typename K>
+template <typename Fn>
+void SSTableReader<K>::multiGet(std::span<const K> keys,
+                                std::span<const BlockHandle> handles,
+                                Fn &&fn) const {
+  assert(keys.size() == handles.size());
+  BlockPin pin;
+  uint64_t pinnedOffset = std::numeric_limits<uint64_t>::max();
+  for (size_t i = 0; i < keys.size(); ++i) {
+    assert(i == 0 || keys[i - 1] <= keys[i]);
+    auto target = encodeKey(keys[i]);
+    auto handle = handles[i];
+    if (handle.offset != pinnedOffset) {
+      pin.block = readDataBlock(handle, pin);
+      pinnedOffset = handle.offset;
+    }
+    auto it = pin.block->lower_bound(target);
+    if (it != pin.block->end() && compare_key(it.key, target) == 0) {
+      fn(i, std::string_view(reinterpret_cast<const char *>(it.value.data()),
+                             it.value.size()));
+    }
+  }
+}
+
+/**
+ * 顺序读取一个sst文件:
+ * 按index block的顺序每次解析一个data block,
+ * value()直接指向映射(或解压后的block)
+ */
+template <typename K> struct SSTableIterator : Iterator<K> {
+  explicit SSTableIterator(std::string fileName)
+      : fileName_(std::move(fileName)) {}
+
+  // 使用已经打开的reader, 例如来自TableCache
+  explicit SSTableIterator(std::shared_ptr<SSTableReader<K>> reader)
+      : reader_(std::move(reader)) {}
+
+  bool valid() override { return valid_; }
+
+  void seekToFirst() override {
+    open();
+    indexIt_ = reader_->indexBlock().begin();
+    loadBlock();
+    dataIt_ = dataBlock_.begin();
+    readCurrent();
+  }
+
+  void seekToLast() override {
+    open();
+    indexIt_ = reader_->indexBlock().last();
+    loadBlock();
+    dataIt_ = dataBlock_.last();
+    readCurrent();
+  }
+
+  void seek(const K &target) override {
+    open();
+    // 第一个最大key >= target的block, 其中一定有key >= target
+    auto encoded = encodeKey(target);
+    indexIt_ = reader_->indexBlock().lower_bound(encoded);
+    loadBlock();
+    dataIt_ = dataBlock_.lower_bound(encoded);
+    readCurrent();
+  }
+
+  void next() override {
+    assert(valid_);
+    ++dataIt_;
+    if (dataIt_ == dataBlock_.end()) {
+      ++indexIt_;
+      loadBlock();
+      dataIt_ = dataBlock_.begin();
+    }
+    readCurrent();
+  }
+
+  void prev() override {
+    assert(valid_);
+    dataIt_ = dataBlock_.before(dataIt_);
+    if (dataIt_ == dataBlock_.end()) {
+      indexIt_ = reader_->indexBlock().before(indexIt_);
+      loadBlock();
+      dataIt_ = dataBlock_.last();
+    }
+    readCurrent();
+  }
+
+  K key() override { return key_; }
+
+  std::string_view value() override { return value_; }
+
+private:
+  void open() {
+    if (reader_ == nullptr) {
+      reader_ = std::make_shared<SSTableReader<K>>(fileName_);
+    }
+  }
+
+  // 解析indexIt_指向的data block, indexIt_越界时清空dataBlock_
+  void loadBlock() {
+    if (indexIt_ == reader_->indexBlock().end()) {
+      dataBlock_ = Block();
+      return;
     }
+    dataBlock_.decode_view(
+        reader_->readBlock(decodeBlockHandle(indexIt_.value), scratch_));
   }
 
-  if (i < kvPairNum_ - 1) {
-    in.read(reinterpret_cast<char *>(&key), sizeof(key));
-    in.read(reinterpret_cast<char *>(&off), sizeof(off));
-    assert(off > offset);
-    targetLen = off - offset;
-  } else if (i == kvPairNum_ - 1) {
-    std::cout << lenOfAllValues_ << '\n';
-    std::cout << offset << '\n';
-    assert(lenOfAllValues_ > offset);
-    targetLen = lenOfAllValues_ - offset;
-  } else {
-    return {};
-  }
-
-  size_t absOffset = 5 * sizeof(uint64_t) + sizeof(bloom_) +
-                     kvPairNum_ * (sizeof(K) + sizeof(uint64_t)) + offset;
-  in.seekg(absOffset);
-  std::string targetStr;
-  targetStr.resize(targetLen);
-  in.read(targetStr.data(), targetLen);
-  in.close();
-  return targetStr;
+  void readCurrent() {
+    valid_ = indexIt_ != reader_->indexBlock().end() &&
+             dataIt_ != dataBlock_.end();
+    if (!valid_) {
+      return;
+    }
+    key_ = decodeKey<K>(dataIt_.key);
+    value_ = std::string_view(
+        reinterpret_cast<const char *>(dataIt_.value.data()),
+        dataIt_.value.size());
+  }
+
+private:
+  std::string fileName_;
+  std::shared_ptr<SSTableReader<K>> reader_;
+  std::vector<uint8_t> scratch_; // 压缩的data block解压后的内容
+  Block dataBlock_;
+  Block::iterator indexIt_;
+  Block::iterator dataIt_;
+  K key_{};
+  std::string_view value_;
+  bool valid_ = false;
+};
+
+template <typename K>
+std::pair<bool, std::string> readSSTableFromFile(std::string fileName, K key) {
+  SSTableReader<K> reader(fileName);
+  std::string_view value;
+  BlockPin pin;
+  if (!reader.get(key, value, pin)) {
+    return {false, {}};
+  }
+  return {true, std::string(value)};
 }
 
 template <typename K, typename V>
 std::list<std::tuple<uint32_t, uint64_t, K, V>>
 filterSSTableFromFile(uint32_t layer, uint64_t serialNum,
                       std::string fileName) {
-  std::ifstream in(fileName, std::ios::in | std::ios::binary);
-  fmt::print("filterSSTableFromFile: open file {}\n", fileName);
-  assert(in.is_open() == true);
-  uint64_t timeStamp_, lenOfAllValues_, minKey_, maxKey_, kvPairNum_;
-  std::bitset<BLOOM_SIZE> bloom_;
-  in.read(reinterpret_cast<char *>(&timeStamp_), sizeof(timeStamp_));
-  in.read(reinterpret_cast<char *>(&lenOfAllValues_), sizeof(lenOfAllValues_));
-  in.read(reinterpret_cast<char *>(&minKey_), sizeof(minKey_));
-  in.read(reinterpret_cast<char *>(&maxKey_), sizeof(maxKey_));
-  in.read(reinterpret_cast<char *>(&kvPairNum_), sizeof(kvPairNum_));
-  in.read(reinterpret_cast<char *>(&bloom_), sizeof(bloom_));
-
-  if (kvPairNum_ == 0) {
-    return {};
-  }
-
-  std::vector<std::pair<K, uint64_t>> keyOffset;
-  K key;
-  uint64_t off;
-  uint64_t targetLen;
-  for (size_t i = 0; i < kvPairNum_; ++i) {
-    in.read(reinterpret_cast<char *>(&key), sizeof(key));
-    in.read(reinterpret_cast<char *>(&off), sizeof(off));
-    keyOffset.emplace_back(key, off);
-  }
+  static_assert(std::is_same_v<V, std::string>,
+                "todo: support V != std::string");
   std::list<std::tuple<uint32_t, uint64_t, K, V>> result;
-
-  for (size_t i = 0; i < keyOffset.size() - 1; ++i) {
-    uint64_t valLen = keyOffset[i + 1].second - keyOffset[i].second;
-    std::string buf;
-    buf.resize(valLen);
-    in.read(buf.data(), valLen);
-    if constexpr (std::is_same_v<V, std::string>) {
-      result.emplace_back(layer, serialNum, keyOffset[i].first, std::move(buf));
-    } else {
-      V value;
-      ::memcpy(&value, buf.c_str(), buf.size());
-      static_assert(true, "ensure value's space enough");
-      static_assert(true, "todo: support V != std::string");
-      /* result.emplace_back(timeStamp_, keyOffset[i].first,
-       * std::move(value));*/
-    }
+  SSTableIterator<K> iter(fileName);
+  for (iter.seekToFirst(); iter.valid(); iter.next()) {
+    result.emplace_back(layer, serialNum, iter.key(), V(iter.value()));
   }
-  // handle last value
-  uint32_t valLen = lenOfAllValues_ - keyOffset.back().second;
-  std::string buf;
-  buf.resize(valLen);
-  in.read(buf.data(), valLen);
-  if constexpr (std::is_same_v<V, std::string>) {
-    result.emplace_back(layer, serialNum, keyOffset.back().first,
-                        std::move(buf));
-  } else {
-    V value;
-    ::memcpy(&value, buf.c_str(), buf.size());
-    static_assert(true, "ensure value's space enough");
-    static_assert(true, "todo: support V != std::string");
-    /* result.emplace_back(timeStamp_, keyOffset.back().first,
-     * std::move(value)); */
-  }
-  in.close();
-
   return result;
 }
 
@@ -218,9 +711,11 @@ template <typename K> struct SummaryOfSSTable {
   K minKey = std::numeric_limits<K>::max();
   K maxKey = std::numeric_limits<K>::min();
   uint64_t kvPairNum = 0;        // kv(offset)的数量
-  std::bitset<BLOOM_SIZE> bloom; // 布隆过滤器
-  std::vector<std::pair<K, uint64_t>> keyOffset;
-  // std::list<std::pair<K, uint64_t>> keyOffset;
+  Filter filter;                 // 过滤器
+  // fence pointer: 每个data block一项, block的最大key -> block的offset.
+  // 常驻内存的只有这些, block内的key在查询时从sst中读取
+  KeyIndex<K> fences;
+  uint64_t dataSize = 0; // 所有data block的总大小, 即最后一个block的结束位置
 
   SummaryOfSSTable() {}
 
@@ -231,27 +726,36 @@ template <typename K> struct SummaryOfSSTable {
                    uint64_t timeStamp_)
       : layer(layer_), serialNum(serialNum_), timeStamp(timeStamp_),
         minKey(st.minKey), maxKey(st.maxKey), kvPairNum(st.kvPairNum),
-        bloom(st.bloom) {
-    // 构建keyOffset
-    auto it = st.kvdata.begin();
-    auto it2 = st.valueOffset.begin();
+        filter(st.filter), dataSize(st.dataSize) {
     assert(st.kvdata.size() == st.valueOffset.size());
-    for (; it2 != st.valueOffset.end(); ++it, ++it2) {
-      keyOffset.emplace_back(it->first, *it2);
+    std::vector<std::pair<K, uint64_t>> keyOffset;
+    auto it = st.valueOffset.begin();
+    for (auto &[k, v] : st.kvdata) {
+      keyOffset.emplace_back(k, *it++);
     }
-    assert(keyOffset.size() == st.kvdata.size());
+    fences = fencesOf(keyOffset);
   }
 
+  template <typename U, typename V>
+  requires(std::is_same_v<K, U>)
+  SummaryOfSSTable(SSTableBuilder<U, V> &builder, uint32_t layer_,
+                   uint64_t serialNum_, uint64_t timeStamp_)
+      : layer(layer_), serialNum(serialNum_), timeStamp(timeStamp_),
+        minKey(builder.minKey), maxKey(builder.maxKey),
+        kvPairNum(builder.kvPairNum), filter(builder.filter),
+        fences(fencesOf(builder.keyOffset)), dataSize(builder.dataSize) {}
+
   // todo
   SummaryOfSSTable(const SummaryOfSSTable<K> &rhs)
       : layer(rhs.layer), serialNum(rhs.serialNum), timeStamp(rhs.timeStamp),
         minKey(rhs.minKey), maxKey(rhs.maxKey), kvPairNum(rhs.kvPairNum),
-        bloom(rhs.bloom), keyOffset(rhs.keyOffset) {}
+        filter(rhs.filter), fences(rhs.fences), dataSize(rhs.dataSize) {}
 
   SummaryOfSSTable(SummaryOfSSTable<K> &&rhs)
       : layer(rhs.layer), serialNum(rhs.serialNum), timeStamp(rhs.timeStamp),
         minKey(rhs.minKey), maxKey(rhs.maxKey), kvPairNum(rhs.kvPairNum),
-        bloom(rhs.bloom), keyOffset(std::move(rhs.keyOffset)) {}
+        filter(std::move(rhs.filter)), fences(std::move(rhs.fences)),
+        dataSize(rhs.dataSize) {}
 
   SummaryOfSSTable &operator=(const SummaryOfSSTable<K> &rhs) {
     layer = rhs.layer;
@@ -260,8 +764,9 @@ template <typename K> struct SummaryOfSSTable {
     minKey = rhs.minKey;
     maxKey = rhs.maxKey;
     kvPairNum = rhs.kvPairNum;
-    bloom = rhs.bloom;
-    keyOffset = rhs.keyOffset;
+    filter = rhs.filter;
+    fences = rhs.fences;
+    dataSize = rhs.dataSize;
     return *this;
   }
 
@@ -272,42 +777,71 @@ template <typename K> struct SummaryOfSSTable {
     minKey = rhs.minKey;
     maxKey = rhs.maxKey;
     kvPairNum = rhs.kvPairNum;
-    bloom = rhs.bloom;
-    keyOffset = std::move(rhs.keyOffset);
+    filter = std::move(rhs.filter);
+    fences = std::move(rhs.fences);
+    dataSize = rhs.dataSize;
     return *this;
   }
 
   ~SummaryOfSSTable() {}
+
+  // 第pos个data block的位置: data block首尾相接, 大小由下一个block的offset得到
+  BlockHandle blockHandle(size_t pos) const {
+    uint64_t offset = fences.offset(pos);
+    uint64_t end = pos + 1 < fences.size() ? fences.offset(pos + 1) : dataSize;
+    return {offset, end - offset};
+  }
+
+  // 由按key有序的(key, 所在block的offset)得到每个block的最大key
+  static KeyIndex<K>
+  fencesOf(const std::vector<std::pair<K, uint64_t>> &keyOffset) {
+    std::vector<K> keys;
+    std::vector<uint64_t> offsets;
+    for (size_t i = 0; i < keyOffset.size(); ++i) {
+      if (i + 1 == keyOffset.size() ||
+          keyOffset[i + 1].second != keyOffset[i].second) {
+        keys.push_back(keyOffset[i].first);
+        offsets.push_back(keyOffset[i].second);
+      }
+    }
+    return KeyIndex<K>(std::move(keys), std::move(offsets));
+  }
 };
 
+
+template <typename K>
+void readSummaryOfSSTable(const SSTableReader<K> &reader,
+                          SummaryOfSSTable<K> &summary) {
+  auto &footer = reader.footer();
+  summary.timeStamp = footer.timeStamp;
+  summary.minKey = footer.minKey;
+  summary.maxKey = footer.maxKey;
+  summary.kvPairNum = footer.kvPairNum;
+
+  summary.dataSize = footer.index.offset;
+
+  [[maybe_unused]] bool ok = summary.filter.decodeFrom(reader.filter());
+  assert(ok == true);
+
+  // index block中已经有每个block的最大key, 不需要读data block.
+  // 解析到局部变量中, reader不保留index block
+  std::vector<K> keys;
+  std::vector<uint64_t> offsets;
+  std::vector<uint8_t> scratch;
+  Block index;
+  if (footer.index.size > 0) {
+    index.decode_view(reader.readBlock(footer.index, scratch));
+  }
+  for (auto [lastKey, handleBuf] : index) {
+    keys.push_back(decodeKey<K>(lastKey));
+    offsets.push_back(decodeBlockHandle(handleBuf).offset);
+  }
+  summary.fences = KeyIndex<K>(std::move(keys), std::move(offsets));
+}
+
 template <typename K>
 void readSummaryOfSSTableFromFile(std::string fileName,
                                   SummaryOfSSTable<K> &summary) {
-  std::ifstream in(fileName, std::ios::in | std::ios::binary);
-  assert(in.is_open() == true);
-  uint64_t timeStamp_, lenOfAllValues_, minKey_, maxKey_, kvPairNum_;
-  std::bitset<BLOOM_SIZE> bloom_;
-  in.read(reinterpret_cast<char *>(&timeStamp_), sizeof(timeStamp_));
-  in.read(reinterpret_cast<char *>(&lenOfAllValues_), sizeof(lenOfAllValues_));
-  in.read(reinterpret_cast<char *>(&minKey_), sizeof(minKey_));
-  in.read(reinterpret_cast<char *>(&maxKey_), sizeof(maxKey_));
-  in.read(reinterpret_cast<char *>(&kvPairNum_), sizeof(kvPairNum_));
-  in.read(reinterpret_cast<char *>(&bloom_), sizeof(bloom_));
-
-  // todo: like &summary.minKey have align problem? if not, use it
-  summary.timeStamp = timeStamp_;
-  summary.minKey = minKey_;
-  summary.maxKey = maxKey_;
-  summary.kvPairNum = kvPairNum_;
-  summary.bloom = bloom_;
-
-  K key;
-  uint64_t off;
-
-  for (uint64_t i = 0; i < kvPairNum_; ++i) {
-    in.read(reinterpret_cast<char *>(&key), sizeof(key));
-    in.read(reinterpret_cast<char *>(&off), sizeof(off));
-    summary.keyOffset.emplace_back(key, off);
-  }
-  in.close();
-}
\ No newline at end of file
+  SSTableReader<K> reader(fileName);
+  readSummaryOfSSTable(reader, summary);
+}
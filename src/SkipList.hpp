@@ -2,47 +2,53 @@
 
 #include <fmt/core.h>
 
+#include "Arena.hpp"
+#include "Iterator.hpp"
 #include "Random.hpp"
 
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <concepts>
 #include <cstddef>
+#include <cstring>
 #include <limits>
 #include <list>
+#include <memory>
+#include <new>
 #include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <tuple>
+#include <type_traits>
 #include <utility>
 
 #include <iostream>
 
-// todo: 如何O(1)获取skiplist的最大key和最小key
+template <typename Key, typename Value> class SkipListIterator;
+
+/**
+ * 并发SkipList:
+ * + insert/search/scan可以被多个线程同时调用, 读不加锁, 写通过CAS链接forward_
+ * + 节点和value从ConcurrentArena分配, 每次insert只分配一次,
+ *   写线程之间只在arena的shard上短暂竞争
+ * + remove/clear会修改已发布的节点, clear还会回收arena,
+ *   两者都需要外部互斥: 调用方保证此时没有其它读写线程
+ */
 template <typename Key, typename Value> struct SkipList {
-  SkipList() : rand_(0x12345678) {
-    // 创建tail_节点, 它节点的level=0
-    // tail节点作为哨兵节点, 避免判断!= nullptr
-    tail_ = new Node<Key, Value>(std::numeric_limits<Key>::max(), Value{}, 0);
-    header_ = new Node<Key, Value>(std::numeric_limits<Key>::min(), Value{},
-                                   MAX_LEVEL);
-    assert(tail_ != nullptr);
-    assert(header_ != nullptr);
-    for (size_t i = 0; i <= MAX_LEVEL; ++i) {
-      header_->forward_[i] = tail_;
-    }
-  }
-  ~SkipList() {
-    Node<Key, Value> *tmp = nullptr;
-    while (header_ != nullptr) {
-      tmp = header_;
-      header_ = header_->forward_[0];
-      delete tmp;
-    }
-  }
+  SkipList() { initSentinel(); }
+
+  // 所有节点都在arena_中, 随arena_一起释放
+  ~SkipList() {}
+
+  SkipList(const SkipList &) = delete;
+  SkipList &operator=(const SkipList &) = delete;
 
-  auto getLevel() { return curLevel_; }
-  auto getMemSize() { return curMemSize; }
+  auto getLevel() { return curLevel_.load(std::memory_order_relaxed); }
+  auto getMemSize() { return curMemSize.load(std::memory_order_relaxed); }
 
-  auto nodeNum() { return nodeCount_; }
+  auto nodeNum() { return nodeCount_.load(std::memory_order_relaxed); }
 
   bool insert(Key key, Value value);
   std::pair<bool, Value> search(Key key);
@@ -55,70 +61,200 @@ template <typename Key, typename Value> struct SkipList {
 
   // O(1)
   std::pair<bool, Key> getMinKey() {
-    if (nodeCount_ == 0) [[unlikely]] {
+    if (nodeNum() == 0) [[unlikely]] {
       return {false, std::numeric_limits<Key>::max()};
     }
-    return {true, header_->forward_[0]->key_};
+    return {true, header_->next(0)->key_};
   }
-  // O(n)
+  // O(logn), 每一层都走到tail_之前的最后一个节点
   std::pair<bool, Key> getMaxKey() {
-    if (nodeCount_ == 0) [[unlikely]] {
+    if (nodeNum() == 0) [[unlikely]] {
       return {false, std::numeric_limits<Key>::max()};
     }
-    Node<Key, Value> *current = header_;
-    for (int i = 0; i < nodeCount_; ++i) {
-      current = current->forward_[0];
+    NodeTypePtr current = header_;
+    for (int i = getLevel(); i >= 0; --i) {
+      while (current->next(i) != tail_) {
+        current = current->next(i);
+      }
     }
     return {true, current->key_};
   }
 
 private:
+  friend class SkipListIterator<Key, Value>;
+
+  // 节点, forward_数组和插入时的value在arena中连续存放:
+  // | key_ | value_ | nodeLevel_ | forward_[0] ... forward_[nodeLevel_] |
+  // | 长度(8字节) | value的字节 |
+  // value_指向 | 长度 | value的字节 |, 覆盖写时指向新分配的value
   template <typename U, typename V> struct Node {
     U key_;
-    V value_;
-    Node<U, V> **forward_;
+    std::atomic<const char *> value_;
     int nodeLevel_; // 用于标识forward的大小
+    std::atomic<Node<U, V> *> forward_[1]; // 实际长度为nodeLevel_ + 1
 
-    // 只要 forward_[i] == nullptr说明到达这条链表的结尾
-    // 给定key和value和level创建节点.
     // 注意, 这里的level是从0开始计数
-    Node(U u, V v, int level)
-        : key_(std::move(u)), value_(std::move(v)), forward_(nullptr),
-          nodeLevel_(level) {
-      forward_ = new Node<U, V> *[level + 1] { nullptr };
-      assert(forward_ != nullptr);
+    Node(U u, const char *v, int level)
+        : key_(std::move(u)), value_(v), nodeLevel_(level) {
       for (int i = 0; i <= level; ++i) {
-        assert(forward_[i] == nullptr);
+        new (&forward_[i]) std::atomic<Node<U, V> *>(nullptr);
       }
     }
 
-    ~Node() {
-      for (int i = 0; i <= nodeLevel_; ++i) {
-        forward_[i] = nullptr;
-      }
-      delete[] forward_;
-      forward_ = nullptr;
+    // acquire保证读到的节点已经完整初始化
+    Node<U, V> *next(int level) {
+      return forward_[level].load(std::memory_order_acquire);
+    }
+
+    void setNext(int level, Node<U, V> *node) {
+      forward_[level].store(node, std::memory_order_release);
+    }
+
+    // 同一层可能有多个线程同时插入, 用CAS链接
+    bool casNext(int level, Node<U, V> *expected, Node<U, V> *node) {
+      return forward_[level].compare_exchange_strong(
+          expected, node, std::memory_order_acq_rel);
     }
   };
 
   using NodeType = Node<Key, Value>;
   using NodeTypePtr = Node<Key, Value> *;
 
+  // 节点和value一次从arena中分配, 节点的析构函数不会被调用
+  NodeTypePtr newNode(const Key &key, const Value &value, int level) {
+    static_assert(std::is_trivially_destructible_v<Key>,
+                  "arena中的节点不会析构, Key必须是trivially destructible");
+    size_t nodeBytes =
+        sizeof(NodeType) +
+        sizeof(std::atomic<NodeTypePtr>) * static_cast<size_t>(level);
+    char *mem = arena_.allocateAligned(nodeBytes + encodedValueSize(value));
+    encodeValue(mem + nodeBytes, value);
+    return new (mem) NodeType(key, mem + nodeBytes, level);
+  }
+
+  // 覆盖写时单独分配value
+  const char *newValue(const Value &value) {
+    char *mem = arena_.allocateAligned(encodedValueSize(value));
+    encodeValue(mem, value);
+    return mem;
+  }
+
+  // 目前只支持V == std::string
+  static size_t encodedValueSize(const Value &value) {
+    static_assert(std::is_same_v<Value, std::string>,
+                  "todo: support V != std::string");
+    return sizeof(uint64_t) + value.size();
+  }
+
+  static void encodeValue(char *mem, const Value &value) {
+    uint64_t len = value.size();
+    ::memcpy(mem, &len, sizeof(len));
+    ::memcpy(mem + sizeof(len), value.data(), len);
+  }
+
+  static uint64_t valueSize(const char *rep) {
+    uint64_t len;
+    ::memcpy(&len, rep, sizeof(len));
+    return len;
+  }
+
+  static Value loadValue(const char *rep) {
+    return Value(rep + sizeof(uint64_t), valueSize(rep));
+  }
+
+  static std::string_view valueView(const char *rep) {
+    return {rep + sizeof(uint64_t), valueSize(rep)};
+  }
+
+  // 第一个key >= key的节点, 不存在时返回tail_
+  NodeTypePtr findGreaterOrEqual(const Key &key) {
+    NodeTypePtr current = header_;
+    for (int i = getLevel(); i >= 0; --i) {
+      while (current->next(i)->key_ < key) {
+        current = current->next(i);
+      }
+    }
+    return current->next(0);
+  }
+
+  // 最后一个key < key的节点, 不存在时返回header_
+  NodeTypePtr findLessThan(const Key &key) {
+    NodeTypePtr current = header_;
+    for (int i = getLevel(); i >= 0; --i) {
+      while (current->next(i) != tail_ && current->next(i)->key_ < key) {
+        current = current->next(i);
+      }
+    }
+    return current;
+  }
+
+  // 最后一个节点, 空表时返回header_
+  NodeTypePtr findLast() {
+    NodeTypePtr current = header_;
+    for (int i = getLevel(); i >= 0; --i) {
+      while (current->next(i) != tail_) {
+        current = current->next(i);
+      }
+    }
+    return current;
+  }
+
+  void initSentinel() {
+    // 创建tail_节点, 它节点的level=0
+    // tail节点作为哨兵节点, 避免判断!= nullptr
+    tail_ = newNode(std::numeric_limits<Key>::max(), Value{}, 0);
+    header_ = newNode(std::numeric_limits<Key>::min(), Value{}, MAX_LEVEL);
+    assert(tail_ != nullptr);
+    assert(header_ != nullptr);
+    for (int i = 0; i <= static_cast<int>(MAX_LEVEL); ++i) {
+      header_->setNext(i, tail_);
+    }
+  }
+
+  // 从before开始, 找到第level层最后一个小于key的节点和它的后继
+  void findSpliceForLevel(const Key &key, NodeTypePtr before, int level,
+                          NodeTypePtr *outPrev, NodeTypePtr *outNext) {
+    while (true) {
+      NodeTypePtr after = before->next(level);
+      if (after->key_ < key) {
+        before = after;
+      } else {
+        *outPrev = before;
+        *outNext = after;
+        return;
+      }
+    }
+  }
+
+  // 每个线程各自持有随机数生成器, 避免共享状态
   int randomLevel() {
-    int level = static_cast<int>(rand_.Uniform(MAX_LEVEL));
+    thread_local Random rand(static_cast<uint32_t>(
+        std::hash<std::thread::id>{}(std::this_thread::get_id())));
+    int level = static_cast<int>(rand.Uniform(MAX_LEVEL));
     if (level == 0) {
       level = 1;
     }
     return level;
   }
 
+  // 更新已存在节点的value&内存占用
+  void updateValue(NodeTypePtr node, const char *rep) {
+    const char *old = node->value_.exchange(rep, std::memory_order_acq_rel);
+    // 因为是无符号数, 先加后减避免出现负数的情况
+    // 旧value占用的arena空间在clear()时一起回收
+    curMemSize.fetch_add(valueSize(rep), std::memory_order_relaxed);
+    curMemSize.fetch_sub(valueSize(old), std::memory_order_relaxed);
+  }
+
 private:
-  uint64_t curMemSize = 0; // 用于记录当前skipList的内存占用大小
+  // 用于记录当前skipList的内存占用大小
+  std::atomic<uint64_t> curMemSize = 0;
   Node<Key, Value> *header_ = nullptr; // key should be Key::min
   Node<Key, Value> *tail_ = nullptr;   // key should be key::max
-  size_t nodeCount_ = 0;
-  int curLevel_ = 0; // 整个SkipList的最大level, 从0开始计数
-  Random rand_;
+  std::atomic<size_t> nodeCount_ = 0;
+  // 整个SkipList的最大level, 从0开始计数, 只会增大(除了remove/clear)
+  std::atomic<int> curLevel_ = 0;
+  ConcurrentArena arena_; // 节点/value的内存都从这里分配
 
 private:
   static constexpr uint32_t MAX_LEVEL = 16; // 调表最大深度
@@ -127,112 +263,116 @@ private:
 // should not insert Key's min and Key's max
 template <typename Key, typename Value>
 bool SkipList<Key, Value>::insert(Key key, Value value) {
-  std::array<NodeTypePtr, SkipList<Key, Value>::MAX_LEVEL> update{};
-  assert(update[1] == nullptr);
+  int rlevel = SkipList<Key, Value>::randomLevel();
 
-  NodeTypePtr current = header_;
-  // 找到每一行最后一个小于key的节点&更新到update中
-  // assume key ∈(0, 0xffffffffffffffff)
-  for (int i = curLevel_; i >= 0; --i) {
-    while (current->forward_[i]->key_ < key) {
-      current = current->forward_[i];
+  // 如果随机的层次更深, 更新curLevel_; 更高的层前驱节点都是header_
+  int maxLevel = getLevel();
+  while (rlevel > maxLevel) {
+    if (curLevel_.compare_exchange_weak(maxLevel, rlevel,
+                                        std::memory_order_relaxed)) {
+      maxLevel = rlevel;
+      break;
     }
-    update[i] = current;
   }
-  // 此时的current位于第0行最后一个小于key的节点
-  current = current->forward_[0];
 
-  // 如果此时current为nullptr呢?
+  std::array<NodeTypePtr, SkipList<Key, Value>::MAX_LEVEL + 1> prev{};
+  std::array<NodeTypePtr, SkipList<Key, Value>::MAX_LEVEL + 1> next{};
+  // 找到每一行最后一个小于key的节点&更新到prev中
+  // assume key ∈(0, 0xffffffffffffffff)
+  NodeTypePtr current = header_;
+  for (int i = maxLevel; i >= 0; --i) {
+    findSpliceForLevel(key, current, i, &prev[i], &next[i]);
+    current = prev[i];
+  }
+
   // 如果key存在, 更新value&内存占用然后返回false
-  if (current->key_ == key) {
-    // 因为是无符号数, 避免出现负数的情况
-    curMemSize -= current->value_.size();
-    curMemSize += value.size();
-    current->value_ = std::move(value);
+  if (next[0]->key_ == key) {
+    updateValue(next[0], newValue(value));
     return false;
   }
 
-  int rlevel = SkipList<Key, Value>::randomLevel();
-  // 如果随机的层次更深，那么需要将我们的header节点(dummy节点)指向正确的位置(这里记录在update中，后续会更新)，并更新curLevel
-  // 因为头节点始终小于新节点.
-  if (rlevel > curLevel_) {
-    // 从curLevel_ + 1开始, 该节点的前一个节点是header_
-    for (int i = curLevel_ + 1; i < rlevel + 1; ++i) {
-      update[i] = header_;
-    }
-    curLevel_ = rlevel;
-  }
-  NodeType *newNode = new NodeType(key, std::move(value), rlevel);
-  assert(newNode != nullptr);
+  NodeTypePtr node = newNode(key, value, rlevel);
+  assert(node != nullptr);
+  // 自底向上链接, 第0层链接成功即代表插入成功, 对读线程可见
   for (int i = 0; i <= rlevel; ++i) {
-    newNode->forward_[i] = update[i]->forward_[i];
-    update[i]->forward_[i] = newNode;
+    while (true) {
+      node->forward_[i].store(next[i], std::memory_order_relaxed);
+      if (prev[i]->casNext(i, next[i], node)) {
+        break;
+      }
+      // CAS失败说明有其它线程在prev[i]之后插入了节点, 从prev[i]重新定位
+      findSpliceForLevel(key, prev[i], i, &prev[i], &next[i]);
+      if (i == 0 && next[0]->key_ == key) {
+        // 其它线程抢先插入了同一个key, 退化为更新, 使用node中的value;
+        // 未链接的node留在arena中, 在clear()时回收
+        updateValue(next[0], node->value_.load(std::memory_order_relaxed));
+        return false;
+      }
+    }
   }
 
   // 更新内存暂用&节点数量
-  curMemSize += (sizeof(Key) + value.size());
-  ++nodeCount_;
+  curMemSize.fetch_add(sizeof(Key) + value.size(), std::memory_order_relaxed);
+  nodeCount_.fetch_add(1, std::memory_order_relaxed);
 
   return true;
 }
 
+// 非线程安全: 需要外部互斥, 调用时不能有其它线程读写
 template <typename Key, typename Value>
 bool SkipList<Key, Value>::remove(Key key) {
-  std::array<NodeTypePtr, SkipList<Key, Value>::MAX_LEVEL> update{};
-  assert(update[1] == nullptr);
+  std::array<NodeTypePtr, SkipList<Key, Value>::MAX_LEVEL + 1> update{};
   NodeTypePtr current = header_;
+  int level = getLevel();
   // 找到每一行最后一个小于key的节点&更新到update中
-  for (int i = curLevel_; i >= 0; --i) {
-    while (current->forward_[i]->key_ < key) {
-      current = current->forward_[i];
+  for (int i = level; i >= 0; --i) {
+    while (current->next(i)->key_ < key) {
+      current = current->next(i);
     }
     update[i] = current;
   }
-  current = current->forward_[0];
+  current = current->next(0);
   // 节点存在才删除
   if (current->key_ == key) {
     // 需要自底向上删除节点
-    for (int i = 0; i <= curLevel_; ++i) {
+    for (int i = 0; i <= level; ++i) {
       // 找到该节点的最顶层即可
       assert(update[i] != nullptr);
-      if (update[i]->forward_[i] != current) {
+      if (update[i]->next(i) != current) {
         break;
       }
-      update[i]->forward_[i] = current->forward_[i];
+      update[i]->setNext(i, current->next(i));
     }
 
     // 删除可能会降低树的高度
     // 更新SkipList整体的高度,
     // 其实高度就等于header_->forward中不为tail_的高度
-    while (curLevel_ > 0 && header_->forward_[curLevel_] == tail_) {
-      --curLevel_;
+    while (level > 0 && header_->next(level) == tail_) {
+      --level;
     }
-    // 更新内存暂用&节点数量
-    curMemSize -= (sizeof(Key) + current->value_.size());
-    delete current; // 释放内存
-    --nodeCount_;
+    curLevel_.store(level, std::memory_order_relaxed);
+    // 节点内存留在arena中, 直到clear()
+    curMemSize.fetch_sub(sizeof(Key) + valueSize(current->value_.load()),
+                         std::memory_order_relaxed);
+    nodeCount_.fetch_sub(1, std::memory_order_relaxed);
     return true;
   }
 
   return false;
 }
 
-
 template <typename Key, typename Value>
 std::pair<bool, Value> SkipList<Key, Value>::search(Key key) {
-  std::array<NodeTypePtr, SkipList<Key, Value>::MAX_LEVEL> update{};
-  assert(update[1] == nullptr);
   NodeTypePtr current = header_;
-  for (int i = curLevel_; i >= 0; --i) {
-    while (current->forward_[i]->key_ < key) {
-      current = current->forward_[i];
+  for (int i = getLevel(); i >= 0; --i) {
+    while (current->next(i)->key_ < key) {
+      current = current->next(i);
     }
-    update[i] = current;
   }
-  current = current->forward_[0];
+  current = current->next(0);
   // 如果存在
   if (current->key_ == key) {
-    return {true, current->value_};
+    return {true, loadValue(current->value_.load(std::memory_order_acquire))};
   }
   return {false, {}};
 }
@@ -243,38 +383,87 @@ void SkipList<Key, Value>::scan(Key startKey, Key endKey,
                                 std::list<std::pair<Key, Value>> &li) {
   assert(startKey <= endKey);
   NodeTypePtr current = header_;
-  for (int i = curLevel_; i >= 0; --i) {
-    while (current->forward_[i]->key_ < startKey) {
-      current = current->forward_[i];
+  for (int i = getLevel(); i >= 0; --i) {
+    while (current->next(i)->key_ < startKey) {
+      current = current->next(i);
     }
   }
-  current = current->forward_[0];
+  current = current->next(0);
   li.clear();
   // if startKey == 0xffffffffffffffff
   if (current == nullptr) [[unlikely]] {
     return;
   }
   while (current->key_ <= endKey && current != tail_) {
-    li.emplace_back(current->key_, current->value_);
-    current = current->forward_[0];
+    li.emplace_back(current->key_,
+                    loadValue(current->value_.load(std::memory_order_acquire)));
+    current = current->next(0);
   }
 }
 
 /**
- * 将所有的kv清空
+ * 将所有的kv清空, 节点不再逐个释放, 由arena一次性回收
+ * 非线程安全: 需要外部互斥, 调用时不能有其它线程读写,
+ * 之前读到的节点和value也随arena一起失效
  */
 template <typename Key, typename Value> void SkipList<Key, Value>::clear() {
-  NodeTypePtr current = header_->forward_[0];
-  while (current != tail_) {
-    NodeTypePtr tmp = current;
-    current = current->forward_[0];
-    delete tmp;
-  }
-  // 修正header的指针
-  for (size_t i = 0; i <= MAX_LEVEL; ++i) {
-    header_->forward_[i] = tail_;
-  }
-  curMemSize = 0;
-  nodeCount_ = 0;
-  curLevel_ = 0;
-}
\ No newline at end of file
+  arena_.reset();
+  initSentinel();
+  curMemSize.store(0, std::memory_order_relaxed);
+  nodeCount_.store(0, std::memory_order_relaxed);
+  curLevel_.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * memtable的迭代器, 持有SkipList的shared_ptr.
+ * 遍历期间可以并发insert, 新插入的节点可能被看到也可能看不到;
+ * 被覆盖的旧value留在arena中, value()返回的view在SkipList销毁前都有效
+ */
+template <typename Key, typename Value>
+class SkipListIterator : public Iterator<Key> {
+  static_assert(std::is_same_v<Value, std::string>,
+                "todo: support V != std::string");
+
+public:
+  explicit SkipListIterator(std::shared_ptr<SkipList<Key, Value>> list)
+      : list_(std::move(list)) {}
+
+  bool valid() override {
+    return node_ != nullptr && node_ != list_->header_ &&
+           node_ != list_->tail_;
+  }
+
+  void seekToFirst() override { node_ = list_->header_->next(0); }
+
+  void seekToLast() override { node_ = list_->findLast(); }
+
+  void seek(const Key &target) override {
+    node_ = list_->findGreaterOrEqual(target);
+  }
+
+  void next() override {
+    assert(valid());
+    node_ = node_->next(0);
+  }
+
+  // 节点没有后向指针, 从头查找前驱, O(logn)
+  void prev() override {
+    assert(valid());
+    node_ = list_->findLessThan(node_->key_);
+  }
+
+  Key key() override {
+    assert(valid());
+    return node_->key_;
+  }
+
+  std::string_view value() override {
+    assert(valid());
+    return SkipList<Key, Value>::valueView(
+        node_->value_.load(std::memory_order_acquire));
+  }
+
+private:
+  std::shared_ptr<SkipList<Key, Value>> list_;
+  typename SkipList<Key, Value>::NodeTypePtr node_ = nullptr;
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "SSTable.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+/**
+ * 已打开的sst的LRU缓存, key为(layer, serialNum):
+ * + 命中时直接返回reader, 不需要拼接路径, open和mmap
+ * + 超过capacity时关闭最久未使用的reader
+ * + compaction删除文件时调用evict, 正在使用的reader由shared_ptr保持有效
+ */
+template <typename K> class TableCache {
+public:
+  using LayerSerial = std::pair<uint32_t, uint64_t>;
+  using ReaderPtr = std::shared_ptr<SSTableReader<K>>;
+  using FileNameFunc = std::function<std::string(uint32_t, uint64_t)>;
+
+  // blockCache非空时, 打开的reader共享这个block cache
+  TableCache(size_t capacity, FileNameFunc fileName,
+             BlockCache *blockCache = nullptr)
+      : capacity_(capacity), fileName_(std::move(fileName)),
+        blockCache_(blockCache) {
+    assert(capacity_ > 0);
+  }
+
+  TableCache(const TableCache &) = delete;
+  TableCache &operator=(const TableCache &) = delete;
+
+  // 未命中时打开文件, 调用方保证文件存在
+  ReaderPtr get(uint32_t layer, uint64_t serialNum) {
+    LayerSerial file{layer, serialNum};
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = index_.find(file);
+      if (it != index_.end()) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return it->second->second;
+      }
+    }
+
+    // 打开文件不持锁, 不阻塞其它文件的查找
+    auto reader = std::make_shared<SSTableReader<K>>(
+        fileName_(layer, serialNum), blockCache_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(file);
+    if (it != index_.end()) {
+      // 其它线程已经打开了同一个文件
+      lru_.splice(lru_.begin(), lru_, it->second);
+      return it->second->second;
+    }
+    lru_.emplace_front(file, reader);
+    index_.emplace(file, lru_.begin());
+    while (lru_.size() > capacity_) {
+      index_.erase(lru_.back().first);
+      lru_.pop_back();
+    }
+    return reader;
+  }
+
+  void evict(uint32_t layer, uint64_t serialNum) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(LayerSerial{layer, serialNum});
+    if (it != index_.end()) {
+      lru_.erase(it->second);
+      index_.erase(it);
+    }
+  }
+
+  size_t size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lru_.size();
+  }
+
+private:
+  using EntryList = std::list<std::pair<LayerSerial, ReaderPtr>>;
+
+  std::mutex mutex_;
+  size_t capacity_;
+  FileNameFunc fileName_;
+  BlockCache *blockCache_;
+  EntryList lru_; // 越靠前越近被使用
+  std::map<LayerSerial, typename EntryList::iterator> index_;
+};
@@ -0,0 +1,287 @@
+#include "WAL.hpp"
+#include "Crc32c.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+void putFixed32(char *dst, uint32_t value) {
+  for (size_t i = 0; i < 4; ++i) {
+    dst[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+  }
+}
+
+uint32_t getFixed32(const char *src) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < 4; ++i) {
+    value |= static_cast<uint32_t>(static_cast<uint8_t>(src[i])) << (8 * i);
+  }
+  return value;
+}
+
+// type和payload的crc
+uint32_t fragmentCrc(WALRecordType type, std::string_view payload) {
+  auto typeByte = static_cast<uint8_t>(type);
+  uint32_t crc = crc32c(&typeByte, 1);
+  return crc32cExtend(crc, reinterpret_cast<const uint8_t *>(payload.data()),
+                      payload.size());
+}
+
+} // namespace
+
+WALWriter::WALWriter(const std::string &fileName) : fileName_(fileName) {
+  fd_ = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+               0644);
+  struct stat st;
+  if (fd_ < 0 || ::fstat(fd_, &st) != 0) {
+    fmt::print("{}: open {} failed\n", __FUNCTION__, fileName);
+    std::abort();
+  }
+  // 追加到已有的文件时从最后一个块的末尾继续
+  blockOffset_ = static_cast<size_t>(st.st_size) % WAL_BLOCK_SIZE;
+}
+
+WALWriter::~WALWriter() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+void WALWriter::addRecord(std::string_view record, bool sync,
+                          const std::function<void()> &apply) {
+  Writer w(record, sync);
+  if (apply) {
+    w.apply = &apply;
+  }
+  commit(w);
+}
+
+void WALWriter::flush() {
+  Writer w({}, false, true);
+  commit(w);
+}
+
+void WALWriter::sync() {
+  Writer w({}, true, true);
+  commit(w);
+}
+
+void WALWriter::commit(Writer &w) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  writers_.push_back(&w);
+  w.cond.wait(lock, [&]() { return w.done || &w == writers_.front(); });
+  if (w.done) {
+    return; // 已经由其它leader写入
+  }
+
+  // 当前线程是leader, 把排在后面的记录一起写入
+  groupBuffer_.clear();
+  group_.clear();
+  bool needSync = false;
+  for (auto *writer : writers_) {
+    if (!group_.empty() &&
+        groupBuffer_.size() + writer->record.size() > MAX_GROUP_SIZE) {
+      break;
+    }
+    if (!writer->barrier) {
+      appendRecord(writer->record);
+    }
+    needSync = needSync || writer->sync;
+    group_.push_back(writer);
+  }
+  bool dirty = unsynced_ || !groupBuffer_.empty();
+  needSync = needSync && dirty;
+
+  // 写文件时不持锁, 新来的线程继续排队, 成为下一组
+  lock.unlock();
+  writeAll(groupBuffer_);
+  if (needSync && ::fdatasync(fd_) != 0) {
+    fmt::print("{}: fdatasync {} failed\n", __FUNCTION__, fileName_);
+    std::abort();
+  }
+  // 同一组的writer都在等待, 按WAL中的顺序替它们调用apply
+  for (auto *writer : group_) {
+    if (writer->apply != nullptr) {
+      (*writer->apply)();
+    }
+  }
+  lock.lock();
+
+  unsynced_ = dirty && !needSync;
+
+  for (size_t i = 0; i < group_.size(); ++i) {
+    Writer *writer = writers_.front();
+    writers_.pop_front();
+    writer->done = true;
+    if (writer != &w) {
+      writer->cond.notify_one();
+    }
+  }
+  if (!writers_.empty()) {
+    writers_.front()->cond.notify_one(); // 下一组的leader
+  }
+}
+
+void WALWriter::appendRecord(std::string_view record) {
+  // 空记录也写入一个Full片段
+  bool begin = true;
+  do {
+    size_t leftover = WAL_BLOCK_SIZE - blockOffset_;
+    if (leftover < WAL_HEADER_SIZE) {
+      groupBuffer_.append(leftover, '\0');
+      blockOffset_ = 0;
+      leftover = WAL_BLOCK_SIZE;
+    }
+    size_t fragmentLen = std::min(record.size(), leftover - WAL_HEADER_SIZE);
+    bool end = fragmentLen == record.size();
+    WALRecordType type = begin && end ? WALRecordType::Full
+                         : begin      ? WALRecordType::First
+                         : end        ? WALRecordType::Last
+                                      : WALRecordType::Middle;
+    appendFragment(type, record.substr(0, fragmentLen));
+    record.remove_prefix(fragmentLen);
+    begin = false;
+  } while (!record.empty());
+}
+
+void WALWriter::appendFragment(WALRecordType type, std::string_view fragment) {
+  assert(fragment.size() <= 0xffff);
+  assert(blockOffset_ + WAL_HEADER_SIZE + fragment.size() <= WAL_BLOCK_SIZE);
+  char header[WAL_HEADER_SIZE];
+  putFixed32(header, crc32cMask(fragmentCrc(type, fragment)));
+  header[4] = static_cast<char>(fragment.size() & 0xff);
+  header[5] = static_cast<char>(fragment.size() >> 8);
+  header[6] = static_cast<char>(type);
+  groupBuffer_.append(header, WAL_HEADER_SIZE);
+  groupBuffer_.append(fragment);
+  blockOffset_ += WAL_HEADER_SIZE + fragment.size();
+}
+
+void WALWriter::writeAll(std::string_view data) {
+  while (!data.empty()) {
+    ssize_t n = ::write(fd_, data.data(), data.size());
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fmt::print("{}: write {} failed\n", __FUNCTION__, fileName_);
+      std::abort();
+    }
+    data.remove_prefix(static_cast<size_t>(n));
+  }
+}
+
+WALReader::WALReader(const std::string &fileName) {
+  fd_ = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0) {
+    fmt::print("{}: open {} failed\n", __FUNCTION__, fileName);
+    std::abort();
+  }
+}
+
+WALReader::~WALReader() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+bool WALReader::readRecord(std::string &record) {
+  record.clear();
+  bool inRecord = false; // 已经读到First, 等待Middle/Last
+  WALRecordType type;
+  std::string_view fragment;
+  while (readFragment(type, fragment)) {
+    switch (type) {
+    case WALRecordType::Full:
+      if (inRecord) {
+        break; // 上一条记录没有结束
+      }
+      record.assign(fragment);
+      return true;
+    case WALRecordType::First:
+      if (inRecord) {
+        break;
+      }
+      record.assign(fragment);
+      inRecord = true;
+      continue;
+    case WALRecordType::Middle:
+      if (!inRecord) {
+        break;
+      }
+      record.append(fragment);
+      continue;
+    case WALRecordType::Last:
+      if (!inRecord) {
+        break;
+      }
+      record.append(fragment);
+      return true;
+    default:
+      break;
+    }
+    corrupted_ = true;
+    return false;
+  }
+  // 文件末尾只写了一部分的记录同样丢弃
+  return false;
+}
+
+bool WALReader::readFragment(WALRecordType &type, std::string_view &fragment) {
+  if (corrupted_) {
+    return false;
+  }
+  // 块末尾不足一个片段头的部分是填充
+  while (remaining_.size() < WAL_HEADER_SIZE) {
+    if (!readBlock()) {
+      return false;
+    }
+  }
+  size_t length = static_cast<uint8_t>(remaining_[4]) |
+                  (static_cast<size_t>(static_cast<uint8_t>(remaining_[5]))
+                   << 8);
+  if (WAL_HEADER_SIZE + length > remaining_.size()) {
+    // 最后一个块中被截断的片段是写入时崩溃的结果, 否则是损坏
+    corrupted_ = !eof_;
+    return false;
+  }
+  type = static_cast<WALRecordType>(remaining_[6]);
+  fragment = remaining_.substr(WAL_HEADER_SIZE, length);
+  uint32_t expected = crc32cUnmask(getFixed32(remaining_.data()));
+  if (fragmentCrc(type, fragment) != expected) {
+    corrupted_ = true;
+    return false;
+  }
+  remaining_.remove_prefix(WAL_HEADER_SIZE + length);
+  return true;
+}
+
+bool WALReader::readBlock() {
+  if (eof_) {
+    return false;
+  }
+  block_.resize(WAL_BLOCK_SIZE);
+  size_t size = 0;
+  while (size < WAL_BLOCK_SIZE) {
+    ssize_t n = ::read(fd_, block_.data() + size, WAL_BLOCK_SIZE - size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      eof_ = true; // 读取失败同样停止
+      break;
+    }
+    size += static_cast<size_t>(n);
+  }
+  block_.resize(size);
+  remaining_ = block_;
+  return size > 0;
+}
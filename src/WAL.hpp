@@ -0,0 +1,130 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * WAL文件格式, 参考LevelDB的log:
+ * + 文件按WAL_BLOCK_SIZE分块, 一条记录可以跨越多个块, 被切成多个片段
+ * + 片段: | crc(4B) | length(2B) | type(1B) | payload |
+ *   crc为type和payload的crc32c(经过crc32cMask), 小端存放
+ * + 块的剩余空间放不下片段头时用0填充, 下一个片段从新的块开始
+ * 损坏只会影响所在的块, 读取时在第一条无法校验的记录处停止
+ */
+enum class WALRecordType : uint8_t {
+  Zero = 0, // 预留, 不会被写入
+  Full = 1, // 完整的记录
+  First = 2,
+  Middle = 3,
+  Last = 4,
+};
+
+inline constexpr size_t WAL_BLOCK_SIZE = 32 * 1024;
+inline constexpr size_t WAL_HEADER_SIZE = 4 + 2 + 1;
+
+/**
+ * WAL的写入端, 一个WAL文件对应一个WALWriter:
+ * + 文件只打开一次, 以O_APPEND追加, 析构时关闭
+ * + group commit: 并发的addRecord排队, 队首的线程作为leader把
+ *   队列中所有记录拼接后一次write(需要时再一次fdatasync),
+ *   其它线程等待leader完成后直接返回
+ * + leader写完之后按记录在文件中的顺序调用每条记录的apply,
+ *   调用完之前下一组不会开始, 所有apply的顺序与WAL中的顺序一致
+ */
+class WALWriter {
+public:
+  explicit WALWriter(const std::string &fileName);
+  ~WALWriter();
+
+  WALWriter(const WALWriter &) = delete;
+  WALWriter &operator=(const WALWriter &) = delete;
+
+  // 返回时记录已经写入文件, sync为true时已经落盘, apply(非空时)已经被调用.
+  // apply用于插入memTable, 保证同一个key的覆盖顺序与重放WAL时相同
+  void addRecord(std::string_view record, bool sync,
+                 const std::function<void()> &apply = nullptr);
+
+  // 等待之前提交的记录全部写入文件
+  void flush();
+
+  // 之前写入的记录全部落盘, 没有未落盘的数据时不调用fdatasync
+  void sync();
+
+private:
+  struct Writer {
+    Writer(std::string_view record_, bool sync_, bool barrier_ = false)
+        : record(record_), sync(sync_), barrier(barrier_) {}
+
+    std::string_view record;
+    bool sync;
+    bool barrier = false; // flush/sync, 没有记录
+    const std::function<void()> *apply = nullptr;
+    bool done = false;
+    std::condition_variable cond;
+  };
+
+  // 排队等待, 成为leader时写入整组
+  void commit(Writer &w);
+
+  // 把record切成片段追加到groupBuffer_
+  void appendRecord(std::string_view record);
+
+  void appendFragment(WALRecordType type, std::string_view fragment);
+
+  void writeAll(std::string_view data);
+
+private:
+  int fd_ = -1;
+  std::string fileName_;
+  std::mutex mutex_;
+  std::deque<Writer *> writers_; // 等待写入的线程, 队首为leader
+  std::string groupBuffer_;      // 只由leader使用
+  std::vector<Writer *> group_;  // 当前组的writer, 只由leader使用
+  size_t blockOffset_ = 0;       // 当前块已经使用的字节数, 只由leader使用
+  bool unsynced_ = false;        // 有写入文件但没有落盘的数据
+
+private:
+  // 一组最多拼接的字节数, 避免单次write过大
+  static constexpr size_t MAX_GROUP_SIZE = 1 << 20;
+};
+
+/**
+ * 顺序读取WALWriter写入的记录, 在文件末尾或第一条损坏的记录处停止:
+ * + 末尾不完整的片段(写入时崩溃)视为文件结束
+ * + crc不匹配, 长度越界, 片段顺序错误视为损坏
+ */
+class WALReader {
+public:
+  explicit WALReader(const std::string &fileName);
+  ~WALReader();
+
+  WALReader(const WALReader &) = delete;
+  WALReader &operator=(const WALReader &) = delete;
+
+  // 读取下一条完整的记录, 返回false时停止读取
+  bool readRecord(std::string &record);
+
+  // 是否因为损坏而停止
+  bool corrupted() const { return corrupted_; }
+
+private:
+  // 读取下一个片段, fragment指向block_
+  bool readFragment(WALRecordType &type, std::string_view &fragment);
+
+  // 读取下一个块到block_, 返回false表示已经没有数据
+  bool readBlock();
+
+private:
+  int fd_ = -1;
+  std::string block_;
+  std::string_view remaining_; // block_中还没有读取的部分
+  bool eof_ = false;
+  bool corrupted_ = false;
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "LSMConfig.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+/**
+ * 一组put/del, 由KVStore::write一次写入:
+ * + 整个batch编码为一条WAL记录, 只追加一次(需要时只fdatasync一次),
+ *   崩溃后重放时要么全部恢复, 要么全部丢弃
+ * + 编码: | count(4B) | entry... |
+ *   entry: | type(1B) | key | [valueLen(8B) | value] |, del没有value部分
+ * + 同一个key出现多次时后面的覆盖前面的
+ * key按内存表示直接拷贝, 只支持trivially copyable的K
+ */
+template <typename K> class WriteBatch {
+  static_assert(std::is_trivially_copyable_v<K>);
+
+public:
+  enum class EntryType : uint8_t {
+    Put = 0,
+    Del = 1,
+  };
+
+  WriteBatch() { clear(); }
+
+  // value超过MAX_VALUE_SIZE时不加入batch, 返回false
+  bool put(const K &key, std::string_view value) {
+    if (value.size() > MAX_VALUE_SIZE) {
+      return false;
+    }
+    appendEntry(EntryType::Put, key);
+    uint64_t valueLen = value.size();
+    rep_.append(reinterpret_cast<const char *>(&valueLen), sizeof(valueLen));
+    rep_.append(value);
+    return true;
+  }
+
+  void del(const K &key) { appendEntry(EntryType::Del, key); }
+
+  void clear() {
+    rep_.assign(HEADER_SIZE, '\0');
+    count_ = 0;
+  }
+
+  uint32_t count() const { return count_; }
+
+  // 编码后的大小, 近似于写入memTable的数据量
+  size_t byteSize() const { return rep_.size(); }
+
+  // 作为WAL记录写入的内容
+  std::string_view data() const { return rep_; }
+
+  // 从WAL记录恢复, 格式错误时返回false
+  bool decodeFrom(std::string_view record) {
+    if (record.size() < HEADER_SIZE) {
+      return false;
+    }
+    uint32_t count;
+    std::memcpy(&count, record.data(), sizeof(count));
+    // 先完整地检查一遍, 不能只恢复一部分
+    std::string_view rest = record.substr(HEADER_SIZE);
+    for (uint32_t i = 0; i < count; ++i) {
+      if (!skipEntry(rest)) {
+        return false;
+      }
+    }
+    if (!rest.empty()) {
+      return false;
+    }
+    rep_.assign(record);
+    count_ = count;
+    return true;
+  }
+
+  // 按加入的顺序调用fn(key, type, value), del的value为空
+  template <typename Fn> void forEach(Fn &&fn) const {
+    const char *ptr = rep_.data() + HEADER_SIZE;
+    for (uint32_t i = 0; i < count_; ++i) {
+      auto type = static_cast<EntryType>(*ptr);
+      K key;
+      std::memcpy(&key, ptr + 1, sizeof(K));
+      ptr += 1 + sizeof(K);
+      std::string_view value;
+      if (type == EntryType::Put) {
+        uint64_t valueLen;
+        std::memcpy(&valueLen, ptr, sizeof(valueLen));
+        value = std::string_view(ptr + sizeof(valueLen), valueLen);
+        ptr += sizeof(valueLen) + valueLen;
+      }
+      fn(key, type, value);
+    }
+  }
+
+private:
+  void appendEntry(EntryType type, const K &key) {
+    rep_.push_back(static_cast<char>(type));
+    rep_.append(reinterpret_cast<const char *>(&key), sizeof(K));
+    ++count_;
+    std::memcpy(rep_.data(), &count_, sizeof(count_));
+  }
+
+  // 跳过rest开头的一个entry, 越界或者type未知时返回false
+  static bool skipEntry(std::string_view &rest) {
+    if (rest.size() < 1 + sizeof(K)) {
+      return false;
+    }
+    auto type = static_cast<EntryType>(rest[0]);
+    rest.remove_prefix(1 + sizeof(K));
+    if (type == EntryType::Del) {
+      return true;
+    }
+    uint64_t valueLen;
+    if (type != EntryType::Put || rest.size() < sizeof(valueLen)) {
+      return false;
+    }
+    std::memcpy(&valueLen, rest.data(), sizeof(valueLen));
+    rest.remove_prefix(sizeof(valueLen));
+    if (valueLen > rest.size() || valueLen > MAX_VALUE_SIZE) {
+      return false;
+    }
+    rest.remove_prefix(valueLen);
+    return true;
+  }
+
+private:
+  std::string rep_;
+  uint32_t count_ = 0;
+
+private:
+  static constexpr size_t HEADER_SIZE = sizeof(uint32_t);
+};
@@ -0,0 +1,154 @@
+#include "XorFilter.hpp"
+#include "KeyHash.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// seed改变时3个位置全部重新分布
+inline uint64_t mix(uint64_t key, uint64_t seed) { return fmix64(key + seed); }
+
+inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+// 把32位均匀映射到[0, n)
+inline size_t reduce(uint32_t hash, size_t n) {
+  return static_cast<size_t>((uint64_t(hash) * n) >> 32);
+}
+
+inline uint8_t fingerprint(uint64_t hash) {
+  return static_cast<uint8_t>(hash ^ (hash >> 32));
+}
+
+struct Slots {
+  size_t h[3];
+};
+
+inline Slots slotsOf(uint64_t hash, size_t blockLength) {
+  return {reduce(static_cast<uint32_t>(hash), blockLength),
+          reduce(static_cast<uint32_t>(rotl64(hash, 21)), blockLength) +
+              blockLength,
+          reduce(static_cast<uint32_t>(rotl64(hash, 42)), blockLength) +
+              2 * blockLength};
+}
+
+} // namespace
+
+XorFilter::XorFilter(std::vector<uint64_t> hashes) {
+  // 重复的key会导致构建永远失败
+  std::sort(hashes.begin(), hashes.end());
+  hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+  if (hashes.empty()) {
+    return;
+  }
+
+  const size_t n = hashes.size();
+  blockLength_ = (32 + n * 123 / 100) / 3 + 1;
+  const size_t capacity = 3 * blockLength_;
+  fingerprints_.assign(capacity, 0);
+
+  std::vector<uint32_t> count(capacity);
+  std::vector<uint64_t> xorMask(capacity); // 落在该槽位的key的mix异或
+  std::vector<size_t> queue;
+  std::vector<std::pair<uint64_t, size_t>> stack; // (mix, 剥离时所在的槽位)
+  queue.reserve(capacity);
+  stack.reserve(n);
+
+  // 剥离失败(图中有环)时换seed重试, 期望重试次数很少
+  for (uint64_t seed = 0x9e3779b97f4a7c15ULL;; seed = mix(seed, 1)) {
+    std::fill(count.begin(), count.end(), 0);
+    std::fill(xorMask.begin(), xorMask.end(), 0);
+    queue.clear();
+    stack.clear();
+
+    for (auto hash : hashes) {
+      uint64_t h = mix(hash, seed);
+      auto slots = slotsOf(h, blockLength_);
+      for (auto slot : slots.h) {
+        ++count[slot];
+        xorMask[slot] ^= h;
+      }
+    }
+
+    // 只被一个key占用的槽位可以留给这个key, 然后把它从另外两个槽位剥离
+    for (size_t i = 0; i < capacity; ++i) {
+      if (count[i] == 1) {
+        queue.push_back(i);
+      }
+    }
+    while (!queue.empty()) {
+      size_t slot = queue.back();
+      queue.pop_back();
+      if (count[slot] != 1) {
+        continue;
+      }
+      uint64_t h = xorMask[slot];
+      stack.emplace_back(h, slot);
+      auto slots = slotsOf(h, blockLength_);
+      for (auto other : slots.h) {
+        --count[other];
+        xorMask[other] ^= h;
+        if (count[other] == 1) {
+          queue.push_back(other);
+        }
+      }
+    }
+
+    if (stack.size() == n) {
+      seed_ = seed;
+      break;
+    }
+  }
+
+  // 逆序赋值: 剥离顺序靠后的key先确定, 不会再被改动
+  for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+    auto [h, slot] = *it;
+    auto slots = slotsOf(h, blockLength_);
+    uint8_t value = fingerprint(h);
+    for (auto other : slots.h) {
+      if (other != slot) {
+        value ^= fingerprints_[other];
+      }
+    }
+    fingerprints_[slot] = value;
+  }
+}
+
+bool XorFilter::mayContain(uint64_t hash) const {
+  if (empty()) {
+    return true; // 没有过滤器时不能排除任何key
+  }
+  uint64_t h = mix(hash, seed_);
+  auto slots = slotsOf(h, blockLength_);
+  return fingerprint(h) == (fingerprints_[slots.h[0]] ^
+                            fingerprints_[slots.h[1]] ^
+                            fingerprints_[slots.h[2]]);
+}
+
+void XorFilter::encodeTo(std::vector<uint8_t> &buf) const {
+  if (empty()) {
+    return;
+  }
+  auto seed = reinterpret_cast<const uint8_t *>(&seed_);
+  buf.insert(buf.end(), seed, seed + sizeof(seed_));
+  buf.insert(buf.end(), fingerprints_.begin(), fingerprints_.end());
+}
+
+bool XorFilter::decodeFrom(std::span<const uint8_t> data) {
+  if (data.empty()) {
+    *this = XorFilter();
+    return true;
+  }
+  if (data.size() < sizeof(seed_) ||
+      (data.size() - sizeof(seed_)) % 3 != 0) {
+    return false;
+  }
+  ::memcpy(&seed_, data.data(), sizeof(seed_));
+  fingerprints_.assign(data.begin() + sizeof(seed_), data.end());
+  blockLength_ = fingerprints_.size() / 3;
+  return true;
+}
+
+bool operator==(const XorFilter &x, const XorFilter &y) {
+  return x.seed_ == y.seed_ && x.fingerprints_ == y.fingerprints_;
+}
@@ -4,6 +4,8 @@
 #include <algorithm>
 
 #include "Block.hpp"
+#include "Compression.hpp"
+#include "Random.hpp"
 
 TEST_CASE("test_Block", "test_Block") {
   BlockBuilder builder(4096);
@@ -33,4 +35,154 @@ TEST_CASE("test_Block", "test_Block") {
     ::memcpy(value.data(), v.data(), v.size());
     fmt::print("{}: {}\n", key, value);
   }
-}
\ No newline at end of file
+}
+TEST_CASE("test_Block_decode_lower_bound", "test_Block_decode_lower_bound") {
+  BlockBuilder builder(4096);
+  // key = key_000, key_002, ..., 按字节序递增
+  for (size_t i = 0; i < 64; i += 2) {
+    std::string key = fmt::format("key_{:03}", i);
+    std::string value = fmt::format("value_{}", i);
+    std::span<uint8_t> keySpan(reinterpret_cast<uint8_t *>(key.data()),
+                               key.size());
+    std::span<uint8_t> valueSpan(reinterpret_cast<uint8_t *>(value.data()),
+                                 value.size());
+    REQUIRE(true == builder.add(keySpan, valueSpan));
+  }
+  auto encoded = builder.build().encode();
+
+  Block block;
+  block.decode(encoded);
+  size_t count = 0;
+  for (auto it = block.begin(); it != block.end(); ++it) {
+    ++count;
+  }
+  REQUIRE(count == 32);
+  REQUIRE(block.restarts_.size() == 2);
+
+  for (size_t i = 0; i < 64; ++i) {
+    std::string target = fmt::format("key_{:03}", i);
+    std::span<const uint8_t> targetSpan(
+        reinterpret_cast<const uint8_t *>(target.data()), target.size());
+    auto it = block.lower_bound(targetSpan);
+    size_t expected = (i + 1) / 2;
+    if (expected == 32) {
+      REQUIRE(it == block.end());
+      continue;
+    }
+    auto [k, v] = *it;
+    REQUIRE(std::string(k.begin(), k.end()) ==
+            fmt::format("key_{:03}", expected * 2));
+    REQUIRE(std::string(v.begin(), v.end()) ==
+            fmt::format("value_{}", expected * 2));
+  }
+}
+
+TEST_CASE("test_Block_prefix_compression", "test_Block_prefix_compression") {
+  // 相邻key共享很长的前缀, 只有restart点保存完整的key
+  constexpr size_t restartInterval = 4;
+  constexpr size_t n = 100;
+  BlockBuilder builder(4096, restartInterval);
+  size_t rawSize = 0;
+  for (size_t i = 0; i < n; ++i) {
+    std::string key = fmt::format("user:000000000000:order:{:05}", i);
+    std::string value = fmt::format("{}", i);
+    rawSize += key.size() + value.size();
+    std::span<uint8_t> keySpan(reinterpret_cast<uint8_t *>(key.data()),
+                               key.size());
+    std::span<uint8_t> valueSpan(reinterpret_cast<uint8_t *>(value.data()),
+                                 value.size());
+    REQUIRE(true == builder.add(keySpan, valueSpan));
+  }
+  auto encoded = builder.build().encode();
+  REQUIRE(encoded.size() < rawSize);
+
+  Block block;
+  block.decode(encoded);
+  REQUIRE(block.restarts_.size() == (n + restartInterval - 1) / restartInterval);
+
+  size_t i = 0;
+  for (auto [k, v] : block) {
+    REQUIRE(std::string(k.begin(), k.end()) ==
+            fmt::format("user:000000000000:order:{:05}", i));
+    REQUIRE(std::string(v.begin(), v.end()) == fmt::format("{}", i));
+    ++i;
+  }
+  REQUIRE(i == n);
+
+  // 每个key都能通过restart点二分找到, 包括restart点之间的key
+  for (i = 0; i < n; ++i) {
+    std::string target = fmt::format("user:000000000000:order:{:05}", i);
+    std::span<const uint8_t> targetSpan(
+        reinterpret_cast<const uint8_t *>(target.data()), target.size());
+    auto it = block.lower_bound(targetSpan);
+    REQUIRE(it != block.end());
+    auto [k, v] = *it;
+    REQUIRE(std::string(k.begin(), k.end()) == target);
+    REQUIRE(std::string(v.begin(), v.end()) == fmt::format("{}", i));
+  }
+  std::string bigger = "user:000000000000:order:99999";
+  REQUIRE(block.lower_bound(std::span<const uint8_t>(
+              reinterpret_cast<const uint8_t *>(bigger.data()),
+              bigger.size())) == block.end());
+
+  // 反向遍历: 跨过restart点时从前一个restart点重新解析
+  i = n;
+  for (auto it = block.last(); it != block.end(); it = block.before(it)) {
+    --i;
+    auto [k, v] = *it;
+    REQUIRE(std::string(k.begin(), k.end()) ==
+            fmt::format("user:000000000000:order:{:05}", i));
+  }
+  REQUIRE(i == 0);
+  Block empty;
+  REQUIRE(empty.last() == empty.end());
+}
+
+TEST_CASE("test_lzCompress", "test_lzCompress") {
+  std::vector<std::vector<uint8_t>> inputs;
+  inputs.emplace_back();                           // 空输入
+  inputs.emplace_back(std::vector<uint8_t>{1, 2}); // 比最短match还短
+  inputs.emplace_back(std::vector<uint8_t>(100000, 'a')); // 长match
+  std::string json;
+  for (size_t i = 0; i < 200; ++i) {
+    json += fmt::format(R"({{"id": {}, "name": "user_{}", "ok": true}})", i,
+                        i % 7);
+  }
+  inputs.emplace_back(json.begin(), json.end());
+  Random rnd(301);
+  std::vector<uint8_t> noise(4096);
+  for (auto &byte : noise) {
+    byte = static_cast<uint8_t>(rnd.Next());
+  }
+  inputs.push_back(noise);
+
+  for (auto &input : inputs) {
+    std::vector<uint8_t> compressed;
+    lzCompress(input, compressed);
+    std::vector<uint8_t> output;
+    REQUIRE(true == lzUncompress(compressed, output));
+    REQUIRE(output == input);
+  }
+
+  // 重复度高的数据压缩效果明显
+  std::vector<uint8_t> compressed;
+  lzCompress(inputs[3], compressed);
+  REQUIRE(compressed.size() * 3 < inputs[3].size());
+
+  // 损坏的数据
+  compressed.resize(compressed.size() / 2);
+  std::vector<uint8_t> output;
+  REQUIRE(false == lzUncompress(compressed, output));
+
+  // 压缩效果不好时存原始数据
+  std::vector<uint8_t> block;
+  REQUIRE(CompressionType::NoCompression ==
+          compressBlock(CompressionType::LZ, noise, block));
+  REQUIRE(block == noise);
+  block.clear();
+  REQUIRE(CompressionType::LZ ==
+          compressBlock(CompressionType::LZ, inputs[3], block));
+  output.clear();
+  REQUIRE(true == uncompressBlock(CompressionType::LZ, block, output));
+  REQUIRE(output == inputs[3]);
+}
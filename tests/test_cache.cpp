@@ -1,17 +1,28 @@
 #include <catch2/catch_test_macros.hpp>
 #include <fmt/format.h>
 
+#include <algorithm>
 #include <bitset>
+#include <cmath>
 #include <concepts>
+#include <filesystem>
 #include <iostream>
+#include <map>
 #include <type_traits>
 #include <vector>
 
 #include <sys/time.h>
 
+#include "BloomFilter.hpp"
 #include "Cache.hpp"
+#include "Filter.hpp"
+#include "KeyHash.hpp"
+#include "Iterator.hpp"
+#include "KeyIndex.hpp"
+#include "Random.hpp"
 #include "SSTable.hpp"
 #include "SkipList.hpp"
+#include "TableCache.hpp"
 
 TEST_CASE("test_SummaryOfSSTable", "test_SummaryOfSSTable") {
 
@@ -41,16 +52,22 @@ TEST_CASE("test_SummaryOfSSTable", "test_SummaryOfSSTable") {
   REQUIRE(summary.minKey == st.minKey);
   REQUIRE(summary.maxKey == st.maxKey);
   REQUIRE(summary.kvPairNum == st.kvPairNum);
-  REQUIRE(st.bloom == summary.bloom);
-  REQUIRE(&(st.bloom) != &(summary.bloom));
+  REQUIRE(st.filter == summary.filter);
+  REQUIRE(&(st.filter) != &(summary.filter));
 
+  // fences: 每个data block一项, 记录block的最大key和offset
+  std::map<uint64_t, size_t> blockMaxKey; // block offset -> 最大key
   auto it = st.kvdata.begin();
-  auto it2 = summary.keyOffset.begin();
-  uint64_t offset = 0;
-  for (; it2 != summary.keyOffset.end(); ++it2, ++it) {
-    REQUIRE(it2->first == it->first);
-    REQUIRE(it2->second == offset);
-    offset += it->second.size();
+  for (auto off : st.valueOffset) {
+    blockMaxKey[off] = (it++)->first;
+  }
+  REQUIRE(blockMaxKey.size() > 1);
+  REQUIRE(summary.fences.size() == blockMaxKey.size());
+  size_t i = 0;
+  for (auto [off, maxKey] : blockMaxKey) {
+    REQUIRE(summary.fences.key(i) == maxKey);
+    REQUIRE(summary.fences.offset(i) == off);
+    ++i;
   }
 
   std::vector<SummaryOfSSTable<size_t>> vec;
@@ -63,17 +80,196 @@ TEST_CASE("test_SummaryOfSSTable", "test_SummaryOfSSTable") {
   REQUIRE(ref.minKey == st.minKey);
   REQUIRE(ref.maxKey == st.maxKey);
   REQUIRE(ref.kvPairNum == st.kvPairNum);
-  REQUIRE(st.bloom == ref.bloom);
-  REQUIRE(&(st.bloom) != &(ref.bloom));
+  REQUIRE(st.filter == ref.filter);
+  REQUIRE(&(st.filter) != &(ref.filter));
+
+  REQUIRE(ref.fences == summary.fences);
+}
+
+TEST_CASE("test_KeyIndex", "test_KeyIndex") {
+  // 覆盖空索引, 不满一个叶子, 以及叶子数不是2的幂的情况
+  for (size_t keyNum : {0, 1, 7, 8, 9, 100, 1000, 4097}) {
+    std::vector<uint64_t> keys, offsets;
+    for (size_t i = 0; i < keyNum; ++i) {
+      keys.push_back(2 * i + 10); // 只有偶数key
+      offsets.push_back(i / 16);
+    }
+    KeyIndex<uint64_t> index(keys, offsets);
+    REQUIRE(index.size() == keyNum);
+    for (size_t i = 0; i < keyNum; ++i) {
+      REQUIRE(index.lowerBound(keys[i]) == i);
+      REQUIRE(index.lowerBound(keys[i] - 1) == i);
+      REQUIRE(index.find(keys[i]) == offsets[i]);
+      REQUIRE(index.find(keys[i] + 1) == std::nullopt);
+    }
+    REQUIRE(index.lowerBound(0) == 0);
+    REQUIRE(index.lowerBound(UINT64_MAX) == keyNum);
+    REQUIRE(index.find(UINT64_MAX) == std::nullopt);
+  }
+
+  // 有符号key: SIMD比较需要保持负数在前
+  std::vector<int64_t> keys;
+  std::vector<uint64_t> offsets;
+  for (int64_t key = -500; key < 500; key += 3) {
+    keys.push_back(key);
+    offsets.push_back(static_cast<uint64_t>(key + 500));
+  }
+  KeyIndex<int64_t> index(keys, offsets);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    REQUIRE(index.find(keys[i]) == offsets[i]);
+    REQUIRE(index.lowerBound(keys[i] - 1) == i);
+  }
+  REQUIRE(index.lowerBound(INT64_MIN) == 0);
+  REQUIRE(index.find(INT64_MAX) == std::nullopt);
+
+  // 最大值作为真实的key
+  KeyIndex<uint32_t> maxKey({1, UINT32_MAX}, {5, 6});
+  REQUIRE(maxKey.find(UINT32_MAX) == 6u);
+  REQUIRE(maxKey.find(UINT32_MAX - 1) == std::nullopt);
+}
+
+TEST_CASE("test_KeyIndex_learned", "test_KeyIndex_learned") {
+  // 均匀分布的key只需要一个分段, 索引比Eytzinger小
+  std::vector<uint64_t> keys, offsets;
+  for (uint64_t i = 0; i < 4096; ++i) {
+    keys.push_back(1000 + 7 * i);
+    offsets.push_back(i);
+  }
+  KeyIndex<uint64_t> uniform(keys, offsets);
+  size_t eytzingerBytes = uniform.indexMemoryUsage();
+  uniform.train(4);
+  REQUIRE(uniform.learned());
+  REQUIRE(uniform.segments() == 1);
+  REQUIRE(uniform.indexMemoryUsage() < eytzingerBytes / 10);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    REQUIRE(uniform.find(keys[i]) == offsets[i]);
+    REQUIRE(uniform.find(keys[i] + 1) == std::nullopt);
+  }
+  REQUIRE(uniform.lowerBound(0) == 0);
+  REQUIRE(uniform.lowerBound(UINT64_MAX) == keys.size());
+
+  // 随机间隔: 结果与std::lower_bound一致
+  Random rand(0x2024);
+  for (size_t maxError : {1, 4, 32}) {
+    keys.clear();
+    offsets.clear();
+    uint64_t key = 0;
+    for (uint64_t i = 0; i < 2000; ++i) {
+      key += 1 + rand.Uniform(i % 100 < 50 ? 4 : 1000);
+      keys.push_back(key);
+      offsets.push_back(i);
+    }
+    KeyIndex<uint64_t> index(keys, offsets);
+    index.train(maxError);
+    REQUIRE(index.segments() > 1);
+    for (uint64_t probe = 0; probe <= key + 1; probe += 1 + rand.Uniform(8)) {
+      auto expected = static_cast<size_t>(
+          std::lower_bound(keys.begin(), keys.end(), probe) - keys.begin());
+      REQUIRE(index.lowerBound(probe) == expected);
+    }
+    index.train(0); // 恢复为Eytzinger查找
+    REQUIRE(index.learned() == false);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      REQUIRE(index.find(keys[i]) == offsets[i]);
+    }
+  }
+}
+
+TEST_CASE("test_BloomFilter", "test_BloomFilter") {
+  constexpr uint64_t keyNum = 10000;
+  BloomFilter bloom(keyNum * 10); // 10 bits/key
+  REQUIRE(bloom.bits() % BloomFilter::BITS_PER_BLOCK == 0);
+  REQUIRE(bloom.bits() >= keyNum * 10);
+  for (uint64_t key = 0; key < keyNum; ++key) {
+    bloom.add(keyHash(key));
+  }
+  // 不存在假阴性
+  for (uint64_t key = 0; key < keyNum; ++key) {
+    REQUIRE(bloom.mayContain(keyHash(key)) == true);
+  }
+  // 不存在的key大部分被过滤
+  size_t falsePositive = 0;
+  for (uint64_t key = keyNum; key < keyNum * 11; ++key) {
+    falsePositive += bloom.mayContain(keyHash(key));
+  }
+  REQUIRE(falsePositive < keyNum * 10 / 50); // < 2%
+
+  std::vector<uint8_t> buf;
+  bloom.encodeTo(buf);
+  REQUIRE(buf.size() * 8 == bloom.bits());
+  BloomFilter decoded;
+  REQUIRE(decoded.decodeFrom(buf) == true);
+  REQUIRE(decoded == bloom);
+  REQUIRE(decoded.decodeFrom(std::span<const uint8_t>(buf.data(), 10)) ==
+          false);
+
+  // 空的过滤器不能排除任何key
+  BloomFilter none;
+  REQUIRE(none.mayContain(keyHash(uint64_t(1))) == true);
+}
+
+TEST_CASE("test_keyHash", "test_keyHash") {
+  // 整数key使用fmix64, 与key的字节数无关
+  REQUIRE(keyHash(uint64_t(42)) == keyHash(uint64_t(42)));
+  REQUIRE(keyHash(uint32_t(42)) == keyHash(uint64_t(42)));
+  REQUIRE(keyHash(int64_t(-1)) == keyHash(UINT64_MAX));
+  REQUIRE(keyHash(uint64_t(0)) != 0);
+
+  // 连续的key的高32位和低32位都要分散, 分别用于选择块和块内的bit
+  constexpr size_t buckets = 64;
+  constexpr uint64_t keyNum = 64 * 1024;
+  std::vector<size_t> high(buckets), low(buckets);
+  for (uint64_t key = 0; key < keyNum; ++key) {
+    uint64_t hash = keyHash(key);
+    ++high[(hash >> 32) % buckets];
+    ++low[static_cast<uint32_t>(hash) % buckets];
+  }
+  for (size_t i = 0; i < buckets; ++i) {
+    REQUIRE(high[i] > keyNum / buckets / 2);
+    REQUIRE(low[i] > keyNum / buckets / 2);
+  }
+}
+
+TEST_CASE("test_BloomFilter_bits_per_key", "test_BloomFilter_bits_per_key") {
+  // 过滤器大小由key数决定
+  for (uint64_t keyNum : {10, 100, 1000}) {
+    SSTableBuilder<uint64_t, std::string> builder(CompressionType::LZ, 10);
+    for (uint64_t key = 0; key < keyNum; ++key) {
+      builder.add(key, "value");
+    }
+    builder.buildFilter();
+    REQUIRE(builder.filter.bits() >= keyNum * 10);
+    REQUIRE(builder.filter.bits() < keyNum * 10 + BloomFilter::BITS_PER_BLOCK);
+  }
+  SSTableBuilder<uint64_t, std::string> noFilter(CompressionType::LZ, 0);
+  noFilter.add(1, "value");
+  noFilter.buildFilter();
+  REQUIRE(noFilter.filter.empty());
+
+  // 各层大小相同时平均分配
+  auto equal = monkeyBitsPerKey(10, {100, 100, 100});
+  for (auto bits : equal) {
+    REQUIRE(std::abs(bits - 10) < 1e-9);
+  }
 
-  auto new_it = st.kvdata.begin();
-  auto new_it2 = ref.keyOffset.begin();
-  uint64_t new_offset = 0;
-  for (; new_it2 != ref.keyOffset.end(); ++new_it2, ++new_it) {
-    REQUIRE(new_it2->first == new_it->first);
-    REQUIRE(new_it2->second == new_offset);
-    new_offset += new_it->second.size();
+  // 层越大分到的越少, 总内存不变
+  std::vector<double> keysPerLevel = {2, 4, 8, 16, 32};
+  auto bits = monkeyBitsPerKey(10, keysPerLevel);
+  double total = 0, budget = 0;
+  for (size_t i = 0; i < bits.size(); ++i) {
+    if (i > 0) {
+      REQUIRE(bits[i] < bits[i - 1]);
+    }
+    total += bits[i] * keysPerLevel[i];
+    budget += 10 * keysPerLevel[i];
   }
+  REQUIRE(std::abs(total - budget) < 1e-6);
+
+  // 预算很少时最大的层不使用过滤器, 其余的层分完全部预算
+  bits = monkeyBitsPerKey(0.1, {1, 2, 4});
+  REQUIRE(bits[2] == 0);
+  REQUIRE(bits[0] > bits[1]);
+  REQUIRE(std::abs(bits[0] * 1 + bits[1] * 2 - 0.1 * 7) < 1e-6);
 }
 
 TEST_CASE("test_Cache", "test_Cache") {
@@ -102,19 +298,21 @@ TEST_CASE("test_Cache", "test_Cache") {
   cache.insert(summary);
   cache.insert(st, layer, serialNum, timeStamp);
   REQUIRE(cache.cacheOfLayer.size() == 2);
+  std::vector<uint64_t> blockOffsets(st.valueOffset.begin(),
+                                     st.valueOffset.end());
   for (size_t i = start; i < range; ++i) {
     // 因为从start开始, 所以需要减去start
-    auto tmpOffset = summary.keyOffset[i - start].second;
-    auto [layer_, serialNum_, offset_] = cache.search(i);
+    auto tmpOffset = blockOffsets[i - start];
+    auto [layer_, serialNum_, block_] = cache.search(i);
     REQUIRE(layer_ == layer);
     REQUIRE(serialNum_ == serialNum);
-    REQUIRE(offset_ == tmpOffset);
+    REQUIRE(block_.offset == tmpOffset);
   }
   // 搜索不到
-  auto [layer_, serialNum_, offset_] = cache.search(range);
+  auto [layer_, serialNum_, block_] = cache.search(range);
   REQUIRE(layer_ == LSM_MAX_LAYER + 1);
   REQUIRE(serialNum_ == 0);
-  REQUIRE(offset_ == 0);
+  REQUIRE(block_ == BlockHandle{});
 
   cache.delByTimestamp(timeStamp);
   REQUIRE(cache.cacheOfLayer.size() == 1);
@@ -122,6 +320,163 @@ TEST_CASE("test_Cache", "test_Cache") {
   REQUIRE(cache.cacheOfLayer.size() == 0);
 }
 
+TEST_CASE("test_Cache_probe", "test_Cache_probe") {
+  // fence只能定位到block: 新文件中没有key时由probe确认, 然后继续查找旧文件
+  SkipList<uint64_t, std::string> oldList, newList;
+  for (uint64_t key = 1; key <= 1000; ++key) {
+    oldList.insert(key, "old");
+    if (key % 2 == 1) {
+      newList.insert(key, "new");
+    }
+  }
+  SSTable<uint64_t, std::string> oldTable(oldList);
+  SSTable<uint64_t, std::string> newTable(newList, CompressionType::LZ, 0);
+  Cache<uint64_t> cache;
+  cache.insert(oldTable, 0, 1, 1);
+  cache.insert(newTable, 0, 2, 2);
+
+  for (uint64_t key = 1; key < 1000; ++key) {
+    std::vector<uint64_t> probed;
+    bool found = cache.search(key, keyHash(key),
+                              [&](uint32_t, uint64_t serialNum, BlockHandle) {
+                                probed.push_back(serialNum);
+                                return serialNum == 1 || key % 2 == 1;
+                              });
+    REQUIRE(found == true);
+    // 新文件没有过滤器, 总是先被检查
+    REQUIRE(probed.front() == 2);
+    REQUIRE(probed.back() == (key % 2 == 1 ? 2 : 1));
+  }
+  bool found = cache.search(uint64_t(1001), keyHash(uint64_t(1001)),
+                            [](uint32_t, uint64_t, BlockHandle) {
+                              return true;
+                            });
+  REQUIRE(found == false);
+}
+
+TEST_CASE("test_Cache_sorted_level", "test_Cache_sorted_level") {
+  // 不重叠的层: 乱序插入后按maxKey有序, 二分查找定位文件
+  Cache<uint64_t> cache(false);
+  constexpr uint64_t fileNum = 8;
+  constexpr uint64_t keysPerFile = 100;
+  for (uint64_t serialNum : {3, 0, 7, 5, 1, 6, 2, 4}) {
+    SkipList<uint64_t, std::string> list;
+    // 每个文件只包含[serialNum * 200 + 1, serialNum * 200 + 100], 之间留有空隙
+    for (uint64_t i = 1; i <= keysPerFile; ++i) {
+      list.insert(serialNum * 2 * keysPerFile + i, "value");
+    }
+    SSTable<uint64_t, std::string> st(list);
+    cache.insert(st, 1, serialNum, serialNum);
+  }
+  REQUIRE(cache.size() == fileNum);
+  for (auto it = cache.begin(); it + 1 != cache.end(); ++it) {
+    REQUIRE(it->maxKey < (it + 1)->minKey);
+  }
+
+  for (uint64_t serialNum = 0; serialNum < fileNum; ++serialNum) {
+    for (uint64_t i = 1; i <= keysPerFile; ++i) {
+      auto [layer, serial, offset] =
+          cache.search(serialNum * 2 * keysPerFile + i);
+      REQUIRE(layer == 1);
+      REQUIRE(serial == serialNum);
+    }
+    // 落在两个文件之间的空隙中
+    auto [layer, serial, offset] =
+        cache.search(serialNum * 2 * keysPerFile + keysPerFile + 1);
+    REQUIRE(layer == LSM_MAX_LAYER + 1);
+  }
+  auto [layer, serial, offset] = cache.search(fileNum * 2 * keysPerFile);
+  REQUIRE(layer == LSM_MAX_LAYER + 1);
+
+  REQUIRE(cache.removeIf([](auto &&summary) {
+    return summary.serialNum % 2 == 0;
+  }) == fileNum / 2);
+  REQUIRE(std::get<0>(cache.search(uint64_t(1))) == LSM_MAX_LAYER + 1);
+  REQUIRE(std::get<1>(cache.search(2 * keysPerFile + 1)) == 1);
+}
+
+TEST_CASE("test_Cache_block_read", "test_Cache_block_read") {
+  // Eytzinger索引找到的block就是点查读取的唯一一个block
+  SSTableBuilder<uint64_t, std::string> builder;
+  constexpr uint64_t keyNum = 3000;
+  for (uint64_t i = 1; i <= keyNum; ++i) {
+    builder.add(i * 3, fmt::format("{:064}", i * 3));
+  }
+  builder.finish("sstable_block_read.txt", 1);
+  SummaryOfSSTable<uint64_t> summary;
+  summary.layer = 1;
+  summary.serialNum = 7;
+  readSummaryOfSSTableFromFile<uint64_t>("sstable_block_read.txt", summary);
+  // 多个叶子, Eytzinger树有多层
+  REQUIRE(summary.fences.size() > 4 * KeyIndex<uint64_t>::LEAF_KEYS);
+
+  Cache<uint64_t> cache(false);
+  cache.insert(std::move(summary));
+  REQUIRE(cache.begin()->fences.learned() == false);
+  SSTableReader<uint64_t> reader("sstable_block_read.txt");
+  BlockPin pin;
+  std::string_view value;
+  for (uint64_t key = 1; key <= keyNum * 3 + 1; ++key) {
+    auto [layer, serialNum, block] = cache.search(key);
+    if (key % 3 == 0) {
+      REQUIRE(layer == 1);
+      REQUIRE(serialNum == 7);
+      REQUIRE(reader.getInBlock(block, key, value, pin) == true);
+      REQUIRE(value == fmt::format("{:064}", key));
+    } else if (layer == 1) {
+      // 过滤器假阳性: block中没有该key
+      REQUIRE(reader.getInBlock(block, key, value, pin) == false);
+    }
+  }
+  std::filesystem::remove("sstable_block_read.txt");
+}
+
+TEST_CASE("test_Cache_learned_block_read", "test_Cache_learned_block_read") {
+  // 学习索引预测的block就是点查读取的block, 不经过Eytzinger索引
+  SSTableBuilder<uint64_t, std::string> builder;
+  std::vector<uint64_t> keys;
+  Random rand(0x1ea2);
+  uint64_t key = 0;
+  for (uint64_t i = 0; i < 4000; ++i) {
+    // 稠密和稀疏的区间交替, 需要多个分段
+    key += 1 + rand.Uniform(i % 1000 < 500 ? 2 : 500);
+    keys.push_back(key);
+    builder.add(key, fmt::format("{:064}", key));
+  }
+  builder.finish("sstable_learned.txt", 1);
+  SummaryOfSSTable<uint64_t> summary;
+  summary.layer = 2;
+  summary.serialNum = 3;
+  readSummaryOfSSTableFromFile<uint64_t>("sstable_learned.txt", summary);
+
+  Cache<uint64_t> cache(false, 2);
+  cache.insert(std::move(summary));
+  auto &fences = cache.begin()->fences;
+  REQUIRE(fences.learned() == true);
+  REQUIRE(fences.segments() > 1);
+
+  SSTableReader<uint64_t> reader("sstable_learned.txt");
+  BlockPin pin;
+  std::string_view value;
+  for (auto k : keys) {
+    auto [layer, serialNum, block] = cache.search(k);
+    REQUIRE(layer == 2);
+    REQUIRE(serialNum == 3);
+    REQUIRE(reader.getInBlock(block, k, value, pin) == true);
+    REQUIRE(value == fmt::format("{:064}", k));
+  }
+  for (uint64_t k = 1; k <= key; k += 1 + rand.Uniform(16)) {
+    auto [layer, serialNum, block] = cache.search(k);
+    bool exists = std::binary_search(keys.begin(), keys.end(), k);
+    if (layer == 2) {
+      REQUIRE(reader.getInBlock(block, k, value, pin) == exists);
+    } else {
+      REQUIRE(exists == false);
+    }
+  }
+  std::filesystem::remove("sstable_learned.txt");
+}
+
 TEST_CASE("filterSSTableFromFile", "filterSSTableFromFile") {
   SkipList<uint64_t, std::string> list;
   constexpr size_t range = 128;
@@ -156,4 +511,442 @@ TEST_CASE("filterSSTableFromFile", "filterSSTableFromFile") {
     REQUIRE(val == fmt::format("key = {}, value = {}", cnt, cnt));
     ++cnt;
   }
-}
\ No newline at end of file
+  std::filesystem::remove("sstable_test.txt");
+}
+TEST_CASE("readSummaryOfSSTableFromFile", "readSummaryOfSSTableFromFile") {
+  SkipList<uint64_t, std::string> list;
+  constexpr size_t range = 1024;
+  constexpr size_t start = 1;
+  for (size_t i = start; i < range; ++i) {
+    REQUIRE(true == list.insert(i, fmt::format("key = {}, value = {}", i, i)));
+  }
+
+  SSTable<uint64_t, std::string> st(list);
+  st.writeToFile("sstable_test.txt", 42);
+  SummaryOfSSTable<uint64_t> expected(st, 0, 0, 42);
+
+  SummaryOfSSTable<uint64_t> summary;
+  readSummaryOfSSTableFromFile<uint64_t>("sstable_test.txt", summary);
+  REQUIRE(summary.timeStamp == 42);
+  REQUIRE(summary.minKey == expected.minKey);
+  REQUIRE(summary.maxKey == expected.maxKey);
+  REQUIRE(summary.kvPairNum == expected.kvPairNum);
+  REQUIRE(summary.filter == expected.filter);
+  REQUIRE(summary.fences == expected.fences);
+  REQUIRE(summary.dataSize == expected.dataSize);
+
+  // fence给出的block与index block一致, 点查只读这一个block
+  SSTableReader<uint64_t> reader("sstable_test.txt");
+  std::vector<BlockHandle> handles;
+  std::vector<uint8_t> scratch;
+  Block index;
+  index.decode_view(reader.readBlock(reader.footer().index, scratch));
+  for (auto [lastKey, handleBuf] : index) {
+    handles.push_back(decodeBlockHandle(handleBuf));
+  }
+  REQUIRE(handles.size() == summary.fences.size());
+  for (size_t i = 0; i < handles.size(); ++i) {
+    REQUIRE(summary.blockHandle(i) == handles[i]);
+    REQUIRE(expected.blockHandle(i) == handles[i]);
+  }
+  BlockPin pin;
+  std::string_view value;
+  for (size_t i = start; i < range; ++i) {
+    auto pos = summary.fences.lowerBound(i);
+    REQUIRE(reader.getInBlock(summary.blockHandle(pos), i, value, pin) == true);
+    REQUIRE(value == fmt::format("key = {}, value = {}", i, i));
+  }
+  // 不在该block中的key
+  REQUIRE(reader.getInBlock(summary.blockHandle(0), range - 1, value, pin) ==
+          false);
+  std::filesystem::remove("sstable_test.txt");
+}
+
+TEST_CASE("test_XorFilter", "test_XorFilter") {
+  constexpr uint64_t keyNum = 10000;
+  std::vector<uint64_t> hashes;
+  for (uint64_t key = 0; key < keyNum; ++key) {
+    hashes.push_back(keyHash(key));
+  }
+  hashes.push_back(hashes.front()); // 重复的hash不影响构建
+  XorFilter xorFilter(hashes);
+  REQUIRE(xorFilter.bits() < keyNum * 10);
+
+  // 没有假阴性, 假阳性率约1/256
+  for (uint64_t key = 0; key < keyNum; ++key) {
+    REQUIRE(xorFilter.mayContain(keyHash(key)) == true);
+  }
+  size_t falsePositive = 0;
+  for (uint64_t key = keyNum; key < keyNum * 11; ++key) {
+    falsePositive += xorFilter.mayContain(keyHash(key));
+  }
+  REQUIRE(falsePositive < keyNum * 10 / 128);
+
+  std::vector<uint8_t> buf;
+  xorFilter.encodeTo(buf);
+  XorFilter decoded;
+  REQUIRE(decoded.decodeFrom(buf) == true);
+  REQUIRE(decoded == xorFilter);
+  REQUIRE(XorFilter().mayContain(keyHash(uint64_t(1))) == true);
+
+  // 类型写在sst中, 读取时按类型解码
+  SkipList<uint64_t, std::string> list;
+  for (uint64_t key = 1; key <= 1000; ++key) {
+    list.insert(key, fmt::format("value{}", key));
+  }
+  SSTable<uint64_t, std::string> st(list, CompressionType::LZ,
+                                    BLOOM_BITS_PER_KEY, FilterType::Xor);
+  REQUIRE(st.filter.type() == FilterType::Xor);
+  st.writeToFile("sstable_xor.txt", 1);
+  SummaryOfSSTable<uint64_t> summary;
+  readSummaryOfSSTableFromFile<uint64_t>("sstable_xor.txt", summary);
+  REQUIRE(summary.filter.type() == FilterType::Xor);
+  REQUIRE(summary.filter == st.filter);
+  for (uint64_t key = 1; key <= 1000; ++key) {
+    REQUIRE(summary.filter.mayContain(keyHash(key)) == true);
+    auto [ok, value] = readSSTableFromFile("sstable_xor.txt", key);
+    REQUIRE(ok == true);
+    REQUIRE(value == fmt::format("value{}", key));
+  }
+  std::filesystem::remove("sstable_xor.txt");
+
+  // 假阳性率1/256时比最优的布隆过滤器(1.44 * 8 bit/key)省内存
+  Filter bloom = Filter::build(FilterType::Bloom, 1.44 * 8, hashes);
+  Filter xorOnly = Filter::build(FilterType::Xor, BLOOM_BITS_PER_KEY, hashes);
+  REQUIRE(double(xorOnly.bits()) < double(bloom.bits()) * 0.9);
+}
+
+TEST_CASE("test_SSTable_compression", "test_SSTable_compression") {
+  SkipList<uint64_t, std::string> list;
+  constexpr size_t range = 1024;
+  constexpr size_t start = 1;
+  for (size_t i = start; i < range; ++i) {
+    REQUIRE(true ==
+            list.insert(i, fmt::format(R"({{"id": {}, "tag": "value"}})", i)));
+  }
+
+  SSTable<uint64_t, std::string> raw(list, CompressionType::NoCompression);
+  raw.writeToFile("sstable_raw.txt", 1);
+  SSTable<uint64_t, std::string> lz(list, CompressionType::LZ);
+  lz.writeToFile("sstable_lz.txt", 1);
+  REQUIRE(std::filesystem::file_size("sstable_lz.txt") <
+          std::filesystem::file_size("sstable_raw.txt"));
+
+  for (auto fileName : {"sstable_raw.txt", "sstable_lz.txt"}) {
+    for (size_t i = start; i < range; ++i) {
+      auto [found, value] = readSSTableFromFile<uint64_t>(fileName, i);
+      REQUIRE(found == true);
+      REQUIRE(value == fmt::format(R"({{"id": {}, "tag": "value"}})", i));
+    }
+    auto result = filterSSTableFromFile<uint64_t, std::string>(0, 0, fileName);
+    REQUIRE(result.size() == range - start);
+    std::filesystem::remove(fileName);
+  }
+}
+
+TEST_CASE("test_SSTableReader", "test_SSTableReader") {
+  SSTableBuilder<uint64_t, std::string> raw(CompressionType::NoCompression);
+  SSTableBuilder<uint64_t, std::string> lz(CompressionType::LZ);
+  for (uint64_t key = 2; key < 2048; key += 2) {
+    raw.add(key, fmt::format("key = {}, value = {}", key, key));
+    lz.add(key, fmt::format("key = {}, value = {}", key, key));
+  }
+  raw.finish("sstable_raw.txt", 7);
+  lz.finish("sstable_lz.txt", 7);
+
+  SSTableReader<uint64_t> rawReader("sstable_raw.txt");
+  SSTableReader<uint64_t> lzReader("sstable_lz.txt");
+  REQUIRE(rawReader.footer().timeStamp == 7);
+  REQUIRE(rawReader.footer().kvPairNum == 1023);
+  BlockPin pin;
+  std::string_view value;
+  for (uint64_t key = 0; key <= 2048; ++key) {
+    bool exist = key % 2 == 0 && key >= 2 && key < 2048;
+    REQUIRE(rawReader.get(key, value, pin) == exist);
+    if (exist) {
+      REQUIRE(value == fmt::format("key = {}, value = {}", key, key));
+    }
+    REQUIRE(lzReader.get(key, value, pin) == exist);
+    if (exist) {
+      REQUIRE(value == fmt::format("key = {}, value = {}", key, key));
+    }
+  }
+
+  // 未压缩的block直接在映射上查找, 不需要scratch
+  pin.scratch.clear();
+  REQUIRE(rawReader.get(100, value, pin) == true);
+  REQUIRE(pin.scratch.empty());
+  REQUIRE(lzReader.get(100, value, pin) == true);
+  auto &scratch = pin.scratch;
+  REQUIRE(value.data() >= reinterpret_cast<const char *>(scratch.data()));
+  REQUIRE(value.data() + value.size() <=
+          reinterpret_cast<const char *>(scratch.data() + scratch.size()));
+  std::filesystem::remove("sstable_raw.txt");
+  std::filesystem::remove("sstable_lz.txt");
+}
+
+TEST_CASE("test_SSTableBuilder_full", "test_SSTableBuilder_full") {
+  // 每个value独占一个data block, 写到index block满为止
+  using Builder = SSTableBuilder<uint64_t, std::string>;
+  Builder builder(CompressionType::NoCompression);
+  uint64_t key = 0;
+  while (!builder.full()) {
+    builder.add(key, std::string(4000, static_cast<char>('a' + key % 26)));
+    ++key;
+  }
+  REQUIRE(key == Builder::MAX_INDEX_ENTRIES);
+  builder.finish("sstable_full.txt", 0);
+
+  SSTableReader<uint64_t> reader("sstable_full.txt");
+  size_t indexEntries = 0;
+  for (auto it = reader.indexBlock().begin(); it != reader.indexBlock().end();
+       ++it) {
+    ++indexEntries;
+  }
+  REQUIRE(indexEntries == Builder::MAX_INDEX_ENTRIES);
+  BlockPin pin;
+  std::string_view value;
+  for (uint64_t k = 0; k < key; k += 97) {
+    REQUIRE(reader.get(k, value, pin) == true);
+    REQUIRE(value == std::string(4000, static_cast<char>('a' + k % 26)));
+  }
+  REQUIRE(reader.get(key - 1, value, pin) == true);
+  std::filesystem::remove("sstable_full.txt");
+}
+
+TEST_CASE("test_TableCache", "test_TableCache") {
+  constexpr uint64_t fileNum = 4;
+  for (uint64_t serialNum = 0; serialNum < fileNum; ++serialNum) {
+    SSTableBuilder<uint64_t, std::string> builder;
+    builder.add(serialNum, fmt::format("file = {}", serialNum));
+    builder.finish(fmt::format("table_cache_{}.sst", serialNum), serialNum);
+  }
+
+  size_t opened = 0;
+  TableCache<uint64_t> cache(2, [&opened](uint32_t, uint64_t serialNum) {
+    ++opened;
+    return fmt::format("table_cache_{}.sst", serialNum);
+  });
+
+  auto first = cache.get(0, 0);
+  REQUIRE(cache.get(0, 0) == first); // 命中时不重新打开
+  REQUIRE(opened == 1);
+  cache.get(0, 1);
+  cache.get(0, 0); // 0比1更近被使用
+  cache.get(0, 2); // 淘汰1
+  REQUIRE(cache.size() == 2);
+  REQUIRE(opened == 3);
+  REQUIRE(cache.get(0, 0) == first);
+  REQUIRE(opened == 3);
+  cache.get(0, 1);
+  REQUIRE(opened == 4);
+
+  // 被淘汰的reader仍然可以继续使用
+  cache.evict(0, 0);
+  REQUIRE(cache.get(0, 0) != first);
+  std::string_view value;
+  BlockPin pin;
+  REQUIRE(first->get(0, value, pin) == true);
+  REQUIRE(value == "file = 0");
+  for (uint64_t serialNum = 0; serialNum < fileNum; ++serialNum) {
+    std::filesystem::remove(fmt::format("table_cache_{}.sst", serialNum));
+  }
+}
+
+TEST_CASE("test_BlockCache", "test_BlockCache") {
+  auto makeBlock = [](size_t valueLen) {
+    BlockBuilder builder(UINT16_MAX);
+    std::string key = "key";
+    std::string value(valueLen, 'v');
+    builder.add(std::span<const uint8_t>(
+                    reinterpret_cast<const uint8_t *>(key.data()), key.size()),
+                std::span<const uint8_t>(
+                    reinterpret_cast<const uint8_t *>(value.data()),
+                    value.size()));
+    return std::make_shared<const Block>(builder.build());
+  };
+
+  // 16个shard, 每个shard 1KB
+  BlockCache cache(16 * KB);
+  REQUIRE(cache.lookup(1, 0) == nullptr);
+  REQUIRE(cache.misses() == 1);
+  auto block = makeBlock(100);
+  cache.insert(1, 0, block);
+  REQUIRE(cache.lookup(1, 0) == block);
+  REQUIRE(cache.hits() == 1);
+  REQUIRE(cache.lookup(2, 0) == nullptr); // 不同文件的同一个offset
+
+  // 写入远超容量的block, 总占用不超过capacity
+  for (uint64_t offset = 0; offset < 1000; ++offset) {
+    cache.insert(3, offset * 4096, makeBlock(500));
+  }
+  REQUIRE(cache.usage() <= cache.capacity());
+  REQUIRE(cache.usage() > cache.capacity() / 2);
+
+  // 被淘汰的block仍然被持有者使用
+  REQUIRE(block->begin() != block->end());
+}
+
+TEST_CASE("test_SSTableReader_BlockCache", "test_SSTableReader_BlockCache") {
+  SSTableBuilder<uint64_t, std::string> builder(CompressionType::LZ);
+  for (uint64_t key = 1; key < 1024; ++key) {
+    builder.add(key, fmt::format("key = {}, value = {}", key, key));
+  }
+  builder.finish("sstable_block_cache.txt", 1);
+
+  BlockCache cache(MB);
+  SSTableReader<uint64_t> reader("sstable_block_cache.txt", &cache);
+  std::string_view value;
+  for (size_t round = 0; round < 2; ++round) {
+    for (uint64_t key = 1; key < 1024; ++key) {
+      BlockPin pin;
+      REQUIRE(reader.get(key, value, pin) == true);
+      REQUIRE(value == fmt::format("key = {}, value = {}", key, key));
+    }
+  }
+  // 每个block只在第一次读取时未命中
+  size_t blockNum = 0;
+  for (auto it = reader.indexBlock().begin(); it != reader.indexBlock().end();
+       ++it) {
+    ++blockNum;
+  }
+  REQUIRE(cache.misses() == blockNum);
+  REQUIRE(cache.hits() == 2 * 1023 - blockNum);
+  std::filesystem::remove("sstable_block_cache.txt");
+}
+
+TEST_CASE("test_MergingIterator", "test_MergingIterator") {
+  // 三个文件的key范围互相重叠, 编号越小越新
+  constexpr size_t fileNum = 3;
+  std::vector<std::unique_ptr<Iterator<uint64_t>>> children;
+  for (size_t f = 0; f < fileNum; ++f) {
+    SSTableBuilder<uint64_t, std::string> builder;
+    for (uint64_t key = 1 + f; key < 256; key += fileNum - f) {
+      builder.add(key, fmt::format("file = {}, key = {}", f, key));
+    }
+    auto fileName = fmt::format("merging_test_{}.sst", f);
+    builder.finish(fileName, f);
+    children.emplace_back(
+        std::make_unique<SSTableIterator<uint64_t>>(fileName));
+  }
+
+  MergingIterator<uint64_t> iter(std::move(children));
+  uint64_t prevKey = 0;
+  size_t distinct = 0;
+  for (iter.seekToFirst(); iter.valid(); iter.next()) {
+    uint64_t key = iter.key();
+    REQUIRE(key >= prevKey);
+    if (key == prevKey) {
+      continue; // 旧版本
+    }
+    prevKey = key;
+    ++distinct;
+    // 第一次出现的一定是包含该key的最新的文件
+    size_t newest = 0;
+    while ((key - 1 - newest) % (fileNum - newest) != 0 || key < 1 + newest) {
+      ++newest;
+    }
+    REQUIRE(iter.value() == fmt::format("file = {}, key = {}", newest, key));
+  }
+  REQUIRE(distinct == 255);
+  for (size_t f = 0; f < fileNum; ++f) {
+    std::filesystem::remove(fmt::format("merging_test_{}.sst", f));
+  }
+}
+
+TEST_CASE("test_SSTableIterator_seek_prev", "test_SSTableIterator_seek_prev") {
+  // key = 2, 4, ..., 4000, 跨越多个data block
+  SSTableBuilder<uint64_t, std::string> builder;
+  for (uint64_t key = 2; key <= 4000; key += 2) {
+    builder.add(key, fmt::format("value = {}", key));
+  }
+  builder.finish("iterator_test.sst", 0);
+  SSTableIterator<uint64_t> iter(std::string("iterator_test.sst"));
+
+  uint64_t expected = 4000;
+  for (iter.seekToLast(); iter.valid(); iter.prev()) {
+    REQUIRE(iter.key() == expected);
+    REQUIRE(iter.value() == fmt::format("value = {}", expected));
+    expected -= 2;
+  }
+  REQUIRE(expected == 0);
+
+  for (uint64_t target = 0; target <= 4001; target += 7) {
+    iter.seek(target);
+    uint64_t first = target + (target % 2) + (target == 0 ? 2 : 0);
+    if (first > 4000) {
+      REQUIRE(!iter.valid());
+      continue;
+    }
+    REQUIRE(iter.key() == first);
+    iter.prev();
+    REQUIRE(iter.valid() == (first > 2));
+    if (iter.valid()) {
+      REQUIRE(iter.key() == first - 2);
+      iter.next();
+      REQUIRE(iter.key() == first);
+    }
+  }
+  std::filesystem::remove("iterator_test.sst");
+}
+
+TEST_CASE("test_MergingIterator_backward", "test_MergingIterator_backward") {
+  // 两个文件的key部分重叠, 相同key的值来自更新的文件0
+  std::vector<std::unique_ptr<Iterator<uint64_t>>> children;
+  std::map<uint64_t, std::string> expected;
+  for (size_t f = 0; f < 2; ++f) {
+    SSTableBuilder<uint64_t, std::string> builder;
+    for (uint64_t key = 1 + f; key < 1000; key += 2 + f) {
+      auto value = fmt::format("file = {}, key = {}", f, key);
+      builder.add(key, value);
+      expected.emplace(key, value); // 文件0先插入
+    }
+    auto fileName = fmt::format("merging_backward_{}.sst", f);
+    builder.finish(fileName, f);
+    children.emplace_back(
+        std::make_unique<SSTableIterator<uint64_t>>(fileName));
+  }
+  MergingIterator<uint64_t> iter(std::move(children));
+
+  // 只保留每个key第一次出现的版本
+  auto collectBackward = [&](std::vector<std::pair<uint64_t, std::string>> &out) {
+    for (; iter.valid(); iter.prev()) {
+      if (out.empty() || out.back().first != iter.key()) {
+        out.emplace_back(iter.key(), std::string(iter.value()));
+      }
+    }
+  };
+  std::vector<std::pair<uint64_t, std::string>> backward;
+  iter.seekToLast();
+  collectBackward(backward);
+  REQUIRE(backward.size() == expected.size());
+  REQUIRE(std::equal(backward.begin(), backward.end(), expected.rbegin(),
+                     [](auto &l, auto &r) {
+                       return l.first == r.first && l.second == r.second;
+                     }));
+
+  // 正反方向交替移动
+  iter.seek(500);
+  auto it = expected.lower_bound(500);
+  for (size_t step = 0; step < 200; ++step) {
+    REQUIRE(iter.key() == it->first);
+    REQUIRE(iter.value() == it->second);
+    if (step % 3 == 2) {
+      do {
+        iter.prev();
+      } while (iter.key() == it->first);
+      --it;
+      // 反向时先遇到最新的版本
+      REQUIRE(iter.value() == it->second);
+    } else {
+      uint64_t current = iter.key();
+      do {
+        iter.next();
+      } while (iter.valid() && iter.key() == current);
+      ++it;
+    }
+  }
+  for (size_t f = 0; f < 2; ++f) {
+    std::filesystem::remove(fmt::format("merging_backward_{}.sst", f));
+  }
+}
@@ -3,8 +3,14 @@
 #include <fmt/core.h>
 #include <fmt/format.h>
 
+#include "Crc32c.hpp"
 #include "KVStore.hpp"
 
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <vector>
+
 struct A {
   std::array<int, 16> arr{};
 };
@@ -73,6 +79,730 @@ TEST_CASE("test_kvstore", "test_kvstore") {
   */
 }
 
+TEST_CASE("test_kvstore_concurrent", "test_kvstore_concurrent") {
+  auto baseDir = std::string("./kv_concurrent/");
+  fs::remove_all(baseDir);
+  constexpr uint64_t threadNum = 4;
+  constexpr uint64_t perThread = 512;
+  {
+    KVStore<uint64_t, std::string> kv(baseDir);
+    std::vector<std::thread> threads;
+    // catch2的断言不是线程安全的, 在线程内只做计数
+    std::atomic<uint64_t> missed = 0;
+    for (uint64_t t = 0; t < threadNum; ++t) {
+      threads.emplace_back([&kv, &missed, t]() {
+        for (uint64_t i = 0; i < perThread; ++i) {
+          uint64_t key = 1 + i * threadNum + t;
+          kv.put(key, fmt::format("key = {}, value = {}", key, key));
+          if (!kv.get(key).first) {
+            ++missed;
+          }
+        }
+      });
+    }
+    for (auto &th : threads) {
+      th.join();
+    }
+    REQUIRE(missed == 0);
+
+    for (uint64_t key = 1; key <= threadNum * perThread; ++key) {
+      auto [ret, value] = kv.get(key);
+      REQUIRE(ret == true);
+      REQUIRE(value == fmt::format("key = {}, value = {}", key, key));
+    }
+  }
+  fs::remove_all(baseDir);
+}
+
+TEST_CASE("test_kvstore_immutable_memtable",
+          "test_kvstore_immutable_memtable") {
+  auto baseDir = std::string("./kv_immutable/");
+  fs::remove_all(baseDir);
+  constexpr uint64_t start = 1;
+  constexpr uint64_t end = 4096;
+  Options options;
+  options.maxImmutableMemTables = 1; // 很容易触发写阻塞
+  {
+    KVStore<uint64_t, std::string> kv(baseDir, options);
+    for (auto i = start; i < end; ++i) {
+      REQUIRE(true == kv.put(i, fmt::format("key = {}, value = {}", i, i)));
+      // 刚写入的数据可能还在immutable memtable中
+      auto [ret, value] = kv.get(i);
+      REQUIRE(ret == true);
+      REQUIRE(value == fmt::format("key = {}, value = {}", i, i));
+    }
+  }
+  // 析构时等待后台flush完成, 重新打开后数据都在sst中
+  {
+    KVStore<uint64_t, std::string> kv(baseDir, options);
+    for (auto i = start; i < end; ++i) {
+      auto [ret, value] = kv.get(i);
+      REQUIRE(ret == true);
+      REQUIRE(value == fmt::format("key = {}, value = {}", i, i));
+    }
+  }
+  fs::remove_all(baseDir);
+}
+
+TEST_CASE("test_kvstore_block_cache", "test_kvstore_block_cache") {
+  auto baseDir = std::string("./kv_block_cache/");
+  fs::remove_all(baseDir);
+  constexpr uint64_t start = 1;
+  constexpr uint64_t end = 4096;
+  {
+    KVStore<uint64_t, std::string> kv(baseDir);
+    for (auto i = start; i < end; ++i) {
+      REQUIRE(true == kv.put(i, fmt::format("key = {}, value = {}", i, i)));
+    }
+  }
+  {
+    KVStore<uint64_t, std::string> kv(baseDir);
+    REQUIRE(kv.blockCache() != nullptr);
+    // 少量热点key反复读取, 只有第一次需要读文件
+    for (size_t round = 0; round < 8; ++round) {
+      for (auto i = start; i < end; i += 512) {
+        auto [ret, value] = kv.get(i);
+        REQUIRE(ret == true);
+        REQUIRE(value == fmt::format("key = {}, value = {}", i, i));
+      }
+    }
+    REQUIRE(kv.blockCache()->misses() <= (end - start) / 512 + 1);
+    REQUIRE(kv.blockCache()->hits() >= 7 * ((end - start) / 512));
+  }
+  {
+    Options options;
+    options.blockCacheCapacity = 0;
+    KVStore<uint64_t, std::string> kv(baseDir, options);
+    REQUIRE(kv.blockCache() == nullptr);
+    auto [ret, value] = kv.get(start);
+    REQUIRE(ret == true);
+  }
+  fs::remove_all(baseDir);
+}
+
+TEST_CASE("test_kvstore_filter_type", "test_kvstore_filter_type") {
+  auto baseDir = std::string("./kv_filter_type/");
+  fs::remove_all(baseDir);
+  constexpr uint64_t keyNum = 4096;
+  Options options;
+  {
+    KVStore<uint64_t, std::string> kv(baseDir, options);
+    for (uint64_t key = 1; key <= keyNum / 2; ++key) {
+      kv.put(key, fmt::format("value{}", key));
+    }
+  }
+  // 切换过滤器类型后, 旧sst仍按其中记录的布隆过滤器查询
+  options.filterType = FilterType::Xor;
+  {
+    KVStore<uint64_t, std::string> kv(baseDir, options);
+    for (uint64_t key = keyNum / 2 + 1; key <= keyNum; ++key) {
+      kv.put(key, fmt::format("value{}", key));
+    }
+    for (uint64_t key = 1; key <= keyNum; ++key) {
+      auto [ret, value] = kv.get(key);
+      REQUIRE(ret == true);
+      REQUIRE(value == fmt::format("value{}", key));
+    }
+    auto [ret, value] = kv.get(keyNum + 1);
+    REQUIRE(ret == false);
+  }
+  fs::remove_all(baseDir);
+}
+
+TEST_CASE("test_kvstore_multiGet", "test_kvstore_multiGet") {
+  auto baseDir = std::string("./kv_multiget/");
+  fs::remove_all(baseDir);
+  std::map<uint64_t, std::string> expected;
+  Random rand(0x5eed);
+  {
+    KVStore<uint64_t, std::string> kv(baseDir);
+    // 覆盖写和删除分布在memtable和多层sst中
+    for (uint64_t i = 0; i < 6000; ++i) {
+      uint64_t key = 1 + rand.Uniform(3000);
+      if (rand.OneIn(6)) {
+        kv.del(key);
+        expected.erase(key);
+      } else {
+        auto value = fmt::format("key = {}, round = {}", key, i);
+        kv.put(key, value);
+        expected[key] = value;
+      }
+    }
+
+    for (size_t batch : {1, 50, 500}) {
+      std::vector<uint64_t> keys;
+      for (size_t i = 0; i < batch; ++i) {
+        keys.push_back(1 + rand.Uniform(3200)); // 包含不存在的key
+      }
+      keys.push_back(keys.front()); // 重复的key
+      auto results = kv.multiGet(keys);
+      REQUIRE(results.size() == keys.size());
+      for (size_t i = 0; i < keys.size(); ++i) {
+        auto it = expected.find(keys[i]);
+        REQUIRE(results[i].first == (it != expected.end()));
+        if (results[i].first) {
+          REQUIRE(results[i].second == it->second);
+        }
+      }
+    }
+    REQUIRE(kv.multiGet(std::span<const uint64_t>()).empty());
+  }
+  {
+    // 全部在sst中: 同一个block中的key只读取一次
+    KVStore<uint64_t, std::string> kv(baseDir);
+    std::vector<uint64_t> keys;
+    for (uint64_t key = 1; key <= 3000; ++key) {
+      keys.push_back(key);
+    }
+    auto misses = kv.blockCache()->misses();
+    auto results = kv.multiGet(keys);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      REQUIRE(results[i].first == (expected.count(keys[i]) > 0));
+    }
+    REQUIRE(kv.blockCache()->misses() - misses < keys.size() / 4);
+  }
+  fs::remove_all(baseDir);
+}
+
+TEST_CASE("test_kvstore_learned_index", "test_kvstore_learned_index") {
+  // 启用学习索引时点查和multiGet都由模型预测的block读取
+  auto baseDir = std::string("./kv_learned/");
+  fs::remove_all(baseDir);
+  Options options;
+  options.learnedIndexError = 1;
+  std::vector<uint64_t> keys;
+  uint64_t key = 0;
+  for (uint64_t i = 0; i < 4000; ++i) {
+    key += i % 400 < 200 ? 1 : 97; // key间隔不均匀
+    keys.push_back(key);
+  }
+  auto check = [&keys](KVStore<uint64_t, std::string> &kv) {
+    for (auto k : keys) {
+      auto [ret, value] = kv.get(k);
+      REQUIRE(ret == true);
+      REQUIRE(value == fmt::format("value = {:032}", k));
+      REQUIRE(kv.get(k + 1).first ==
+              std::binary_search(keys.begin(), keys.end(), k + 1));
+    }
+    auto results = kv.multiGet(keys);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      REQUIRE(results[i].first == true);
+      REQUIRE(results[i].second == fmt::format("value = {:032}", keys[i]));
+    }
+  };
+  {
+    KVStore<uint64_t, std::string> kv(baseDir, options);
+    for (auto k : keys) {
+      kv.put(k, fmt::format("value = {:032}", k));
+    }
+    check(kv);
+  }
+  {
+    // 重新打开时从sst读取summary并训练模型
+    KVStore<uint64_t, std::string> kv(baseDir, options);
+    check(kv);
+  }
+  fs::remove_all(baseDir);
+}
+
+TEST_CASE("test_kvstore_max_value_size", "test_kvstore_max_value_size") {
+  auto baseDir = std::string("./kv_max_value_size/");
+  fs::remove_all(baseDir);
+  {
+    KVStore<uint64_t, std::string> kv(baseDir);
+    REQUIRE(kv.put(1, std::string(MAX_VALUE_SIZE + 1, 'x')) == false);
+    REQUIRE(kv.get(1).first == false);
+    REQUIRE(kv.put(2, std::string(MAX_VALUE_SIZE, 'y')) == true);
+  }
+  {
+    // 经过flush之后长度不变
+    KVStore<uint64_t, std::string> kv(baseDir);
+    REQUIRE(kv.get(1).first == false);
+    REQUIRE(kv.get(2).second == std::string(MAX_VALUE_SIZE, 'y'));
+  }
+  fs::remove_all(baseDir);
+}
+
+TEST_CASE("test_kvstore_scan", "test_kvstore_scan") {
+  auto baseDir = std::string("./kv_scan/");
+  fs::remove_all(baseDir);
+  std::map<uint64_t, std::string> expected;
+  Random rand(0x5ca9);
+  {
+    KVStore<uint64_t, std::string> kv(baseDir);
+    // 覆盖写和删除分布在memtable和多层sst中
+    for (uint64_t i = 0; i < 6000; ++i) {
+      uint64_t key = 1 + rand.Uniform(3000);
+      if (rand.OneIn(6)) {
+        kv.del(key);
+        expected.erase(key);
+      } else {
+        auto value = fmt::format("key = {}, round = {}", key, i);
+        kv.put(key, value);
+        expected[key] = value;
+      }
+    }
+
+    auto iter = kv.newIterator();
+    auto it = expected.begin();
+    for (iter->seekToFirst(); iter->valid(); iter->next(), ++it) {
+      REQUIRE(it != expected.end());
+      REQUIRE(iter->key() == it->first);
+      REQUIRE(iter->value() == it->second);
+    }
+    REQUIRE(it == expected.end());
+
+    auto rit = expected.rbegin();
+    for (iter->seekToLast(); iter->valid(); iter->prev(), ++rit) {
+      REQUIRE(rit != expected.rend());
+      REQUIRE(iter->key() == rit->first);
+      REQUIRE(iter->value() == rit->second);
+    }
+    REQUIRE(rit == expected.rend());
+
+    for (size_t i = 0; i < 100; ++i) {
+      uint64_t start = rand.Uniform(3200);
+      uint64_t end = start + rand.Uniform(100);
+      auto result = kv.scan(start, end);
+      auto first = expected.lower_bound(start);
+      auto last = expected.upper_bound(end);
+      REQUIRE(result.size() == static_cast<size_t>(std::distance(first, last)));
+      REQUIRE(std::equal(result.begin(), result.end(), first,
+                         [](auto &l, auto &r) {
+                           return l.first == r.first && l.second == r.second;
+                         }));
+
+      // seek之后先后退再前进
+      iter->seek(start);
+      if (first == expected.end()) {
+        REQUIRE(!iter->valid());
+        continue;
+      }
+      REQUIRE(iter->key() == first->first);
+      iter->prev();
+      if (first == expected.begin()) {
+        REQUIRE(!iter->valid());
+        continue;
+      }
+      REQUIRE(iter->key() == std::prev(first)->first);
+      iter->next();
+      REQUIRE(iter->key() == first->first);
+    }
+
+    // 迭代器创建之后的flush和compaction删除的文件仍然可以读取,
+    // 创建时的memtable上的新写入可能被看到
+    auto snapshot = kv.newIterator();
+    for (uint64_t key = 1; key <= 3000; ++key) {
+      kv.put(key, "overwritten");
+    }
+    size_t count = 0;
+    for (snapshot->seekToFirst(); snapshot->valid(); snapshot->next()) {
+      ++count;
+      if (snapshot->value() != "overwritten") {
+        REQUIRE(snapshot->value() == expected.at(snapshot->key()));
+      }
+    }
+    REQUIRE(count >= expected.size());
+    REQUIRE(kv.scan(1, 3000).size() == 3000);
+  }
+  fs::remove_all(baseDir);
+}
+
+TEST_CASE("test_kvstore_background_compaction",
+          "test_kvstore_background_compaction") {
+  auto baseDir = std::string("./kv_compaction/");
+  fs::remove_all(baseDir);
+  Options options;
+  options.compactionThreads = 4;
+  options.bloomPerLevelAllocation = true;
+  options.learnedIndexError = 8;
+  std::map<uint64_t, std::string> expected;
+  Random rand(0x12345678);
+  {
+    KVStore<uint64_t, std::string> kv(baseDir, options);
+    // 随机覆盖写和删除, 产生多层且key范围重叠的sst
+    for (uint64_t i = 0; i < 8192; ++i) {
+      uint64_t key = 1 + rand.Uniform(2048);
+      if (rand.OneIn(8)) {
+        kv.del(key);
+        expected.erase(key);
+      } else {
+        auto value = fmt::format("key = {}, round = {}", key, i);
+        kv.put(key, value);
+        expected[key] = value;
+      }
+    }
+    for (uint64_t key = 1; key <= 2048; ++key) {
+      auto [ret, value] = kv.get(key);
+      auto it = expected.find(key);
+      REQUIRE(ret == (it != expected.end()));
+      if (ret) {
+        REQUIRE(value == it->second);
+      }
+    }
+  }
+  {
+    KVStore<uint64_t, std::string> kv(baseDir, options);
+    for (uint64_t key = 1; key <= 2048; ++key) {
+      auto [ret, value] = kv.get(key);
+      auto it = expected.find(key);
+      REQUIRE(ret == (it != expected.end()));
+      if (ret) {
+        REQUIRE(value == it->second);
+      }
+    }
+  }
+  fs::remove_all(baseDir);
+}
+
+TEST_CASE("test_WALWriter_group_commit", "test_WALWriter_group_commit") {
+  auto fileName = std::string("group_commit.log");
+  fs::remove(fileName);
+  constexpr size_t threadNum = 8;
+  constexpr size_t recordNum = 500;
+  std::vector<std::string> applied; // apply串行调用, 不需要加锁
+  {
+    WALWriter wal(fileName);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadNum; ++t) {
+      threads.emplace_back([&wal, &applied, t]() {
+        for (size_t i = 0; i < recordNum; ++i) {
+          // 固定长度的记录, 便于检查是否交错
+          auto record = fmt::format("[{:02}:{:04}]", t, i);
+          wal.addRecord(record, i % 10 == 0,
+                        [&applied, &record]() { applied.push_back(record); });
+        }
+      });
+    }
+    for (auto &th : threads) {
+      th.join();
+    }
+  }
+
+  // 每个线程的记录完整并且保持顺序
+  WALReader reader(fileName);
+  std::vector<size_t> nextOfThread(threadNum, 0);
+  std::string record;
+  size_t count = 0;
+  REQUIRE(applied.size() == threadNum * recordNum);
+  while (reader.readRecord(record)) {
+    // apply的顺序与WAL中的顺序相同
+    REQUIRE(record == applied[count]);
+    size_t t = std::stoul(record.substr(1, 2));
+    size_t i = std::stoul(record.substr(4, 4));
+    REQUIRE(record == fmt::format("[{:02}:{:04}]", t, i));
+    REQUIRE(i == nextOfThread[t]++);
+    ++count;
+  }
+  REQUIRE(!reader.corrupted());
+  REQUIRE(count == threadNum * recordNum);
+  fs::remove(fileName);
+}
+
+TEST_CASE("test_crc32c", "test_crc32c") {
+  auto crcOf = [](std::string_view data) {
+    return crc32c(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+  };
+  // RFC 3720 B.4中的测试数据
+  std::vector<uint8_t> zeros(32, 0), ones(32, 0xff), ascending(32);
+  for (uint8_t i = 0; i < 32; ++i) {
+    ascending[i] = i;
+  }
+  REQUIRE(crc32c(zeros.data(), zeros.size()) == 0x8a9136aaU);
+  REQUIRE(crc32c(ones.data(), ones.size()) == 0x62a8ab43U);
+  REQUIRE(crc32c(ascending.data(), ascending.size()) == 0x46dd794eU);
+  REQUIRE(crcOf("123456789") == 0xe3069283U);
+
+  // 分段计算与一次计算相同, 覆盖不足8字节的尾部
+  std::string data = "hello world, this is a crc32c test";
+  for (size_t split = 0; split <= data.size(); ++split) {
+    uint32_t crc = crcOf(data.substr(0, split));
+    crc = crc32cExtend(crc,
+                       reinterpret_cast<const uint8_t *>(data.data()) + split,
+                       data.size() - split);
+    REQUIRE(crc == crcOf(data));
+  }
+  REQUIRE(crcOf("a") != crcOf("b"));
+  REQUIRE(crc32cUnmask(crc32cMask(crcOf(data))) == crcOf(data));
+  REQUIRE(crc32cMask(crcOf(data)) != crcOf(data));
+}
+
+TEST_CASE("test_WALReader", "test_WALReader") {
+  auto fileName = std::string("wal_reader.log");
+  fs::remove(fileName);
+  // 长度覆盖空记录, 块内的记录和跨越多个块的记录
+  std::vector<std::string> records;
+  Random rand(0x3a1);
+  for (size_t i = 0; i < 200; ++i) {
+    size_t len = i == 0 ? 0 : rand.Uniform(i % 20 == 0 ? 100000 : 1000);
+    records.emplace_back(len, static_cast<char>('a' + i % 26));
+  }
+  {
+    WALWriter wal(fileName);
+    for (auto &record : records) {
+      wal.addRecord(record, false);
+    }
+  }
+  auto fileSize = fs::file_size(fileName);
+
+  auto readAll = [&](bool &corrupted) {
+    WALReader reader(fileName);
+    std::vector<std::string> result;
+    std::string record;
+    while (reader.readRecord(record)) {
+      result.push_back(record);
+    }
+    corrupted = reader.corrupted();
+    return result;
+  };
+  bool corrupted = false;
+  REQUIRE(readAll(corrupted) == records);
+  REQUIRE(!corrupted);
+
+  // 末尾被截断: 丢弃不完整的记录, 不视为损坏
+  fs::resize_file(fileName, fileSize - 10);
+  auto result = readAll(corrupted);
+  REQUIRE(!corrupted);
+  REQUIRE(result.size() == records.size() - 1);
+  REQUIRE(std::equal(result.begin(), result.end(), records.begin()));
+
+  // 中间的一个字节被修改: 在所在的记录处停止
+  {
+    std::fstream file(fileName, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(static_cast<std::streamoff>(fileSize / 2));
+    file.put('\x7f');
+  }
+  result = readAll(corrupted);
+  REQUIRE(corrupted);
+  REQUIRE(result.size() < records.size() - 1);
+  REQUIRE(std::equal(result.begin(), result.end(), records.begin()));
+  fs::remove(fileName);
+}
+
+TEST_CASE("test_kvstore_wal_replay", "test_kvstore_wal_replay") {
+  auto baseDir = std::string("./kv_wal_replay/");
+  fs::remove_all(baseDir);
+  fs::create_directories(baseDir + "log/");
+  {
+    // 模拟崩溃前留下的WAL, 最后一条记录不完整
+    WALWriter wal(baseDir + "log/wal_3.log");
+    for (uint64_t key = 1; key <= 100; ++key) {
+      WriteBatch<uint64_t> batch;
+      batch.put(key, fmt::format("value = {}", key));
+      std::string record(batch.data());
+      if (key == 100) {
+        record.resize(record.size() - 1);
+      }
+      wal.addRecord(record, false);
+    }
+  }
+  {
+    KVStore<uint64_t, std::string> kv(baseDir);
+    for (uint64_t key = 1; key < 100; ++key) {
+      auto [hasKey, value] = kv.get(key);
+      REQUIRE(hasKey);
+      REQUIRE(value == fmt::format("value = {}", key));
+    }
+    REQUIRE(kv.get(100).first == false);
+    REQUIRE(!fs::exists(baseDir + "log/wal_3.log"));
+  }
+  fs::remove_all(baseDir);
+}
+
+TEST_CASE("test_kvstore_wal_order", "test_kvstore_wal_order") {
+  // 多个线程并发覆盖同一个key: 重放WAL得到的值与崩溃前读到的值相同
+  auto baseDir = std::string("./kv_wal_order/");
+  auto walCopy = std::string("./kv_wal_order.log");
+  for (size_t round = 0; round < 5; ++round) {
+    fs::remove_all(baseDir);
+    std::string lastValue;
+    {
+      KVStore<uint64_t, std::string> kv(baseDir);
+      std::vector<std::thread> threads;
+      for (size_t t = 0; t < 8; ++t) {
+        threads.emplace_back([&kv, t]() {
+          for (size_t i = 0; i < 50; ++i) {
+            kv.put(7, fmt::format("t{}-{}", t, i), WriteOptions{.sync = false});
+          }
+        });
+      }
+      for (auto &th : threads) {
+        th.join();
+      }
+      kv.syncWAL();
+      lastValue = kv.get(7).second;
+
+      // 数据都在memTable中, 复制WAL模拟崩溃时留下的文件
+      std::vector<fs::path> logs;
+      for (auto &entry : fs::directory_iterator(baseDir + "log/")) {
+        logs.push_back(entry.path());
+      }
+      REQUIRE(logs.size() == 1);
+      fs::copy_file(logs.front(), walCopy,
+                    fs::copy_options::overwrite_existing);
+    }
+    fs::remove_all(baseDir);
+    fs::create_directories(baseDir + "log/");
+    fs::copy_file(walCopy, baseDir + "log/wal_0.log");
+    {
+      KVStore<uint64_t, std::string> kv(baseDir);
+      REQUIRE(kv.get(7).second == lastValue);
+    }
+  }
+  fs::remove_all(baseDir);
+  fs::remove(walCopy);
+}
+
+TEST_CASE("test_kvstore_write_options", "test_kvstore_write_options") {
+  auto baseDir = std::string("./kv_write_options/");
+  fs::remove_all(baseDir);
+  {
+    KVStore<uint64_t, std::string> kv(baseDir);
+    WriteOptions buffered{.sync = false};
+    WriteOptions noWAL{.sync = false, .disableWAL = true};
+    for (uint64_t key = 0; key < 30; ++key) {
+      auto value = fmt::format("value = {}", key);
+      if (key < 10) {
+        kv.put(key, value);
+      } else if (key < 20) {
+        kv.put(key, value, buffered);
+      } else {
+        kv.put(key, value, noWAL);
+      }
+    }
+    kv.del(5, buffered);
+    kv.flushWAL();
+    kv.syncWAL();
+
+    // 只有一个WAL, 其中没有disableWAL的写入
+    std::vector<fs::path> logs;
+    for (auto &entry : fs::directory_iterator(baseDir + "log/")) {
+      logs.push_back(entry.path());
+    }
+    REQUIRE(logs.size() == 1);
+    WALReader reader(logs.front().string());
+    std::string record;
+    std::vector<uint64_t> keys;
+    WriteBatch<uint64_t> batch;
+    while (reader.readRecord(record)) {
+      REQUIRE(batch.decodeFrom(record));
+      REQUIRE(batch.count() == 1);
+      batch.forEach([&](uint64_t key, auto, std::string_view) {
+        keys.push_back(key);
+      });
+    }
+    REQUIRE(!reader.corrupted());
+    REQUIRE(keys.size() == 21);
+    REQUIRE(keys.back() == 5);
+    REQUIRE(*std::max_element(keys.begin(), keys.end()) == 19);
+
+    for (uint64_t key = 0; key < 30; ++key) {
+      REQUIRE(kv.get(key).first == (key != 5));
+    }
+  }
+  fs::remove_all(baseDir);
+}
+
+TEST_CASE("test_kvstore_write_batch", "test_kvstore_write_batch") {
+  auto baseDir = std::string("./kv_write_batch/");
+  fs::remove_all(baseDir);
+  {
+    KVStore<uint64_t, std::string> kv(baseDir);
+    kv.put(1, "old");
+    kv.put(2, "old");
+
+    // 比MEM_LIMIT大的batch也写入同一个memTable, flush时切分成多个sst
+    WriteBatch<uint64_t> batch;
+    REQUIRE(batch.put(1, std::string(MAX_VALUE_SIZE + 1, 'x')) == false);
+    REQUIRE(batch.count() == 0);
+    for (uint64_t key = 1; key <= 1000; ++key) {
+      batch.put(key, fmt::format("batch value = {}", key));
+    }
+    batch.del(2);
+    batch.put(1, "overwritten in batch");
+    REQUIRE(batch.count() == 1002);
+    kv.write(batch);
+
+    REQUIRE(kv.get(1).second == "overwritten in batch");
+    REQUIRE(kv.get(2).first == false);
+    for (uint64_t key = 3; key <= 1000; ++key) {
+      REQUIRE(kv.get(key).second == fmt::format("batch value = {}", key));
+    }
+
+    // 整个batch只有一条WAL记录
+    std::vector<fs::path> logs;
+    for (auto &entry : fs::directory_iterator(baseDir + "log/")) {
+      logs.push_back(entry.path());
+    }
+    REQUIRE(logs.size() == 1);
+    WALReader reader(logs.front().string());
+    std::string record;
+    REQUIRE(reader.readRecord(record));
+    REQUIRE(record == batch.data());
+    REQUIRE(!reader.readRecord(record));
+
+    batch.clear();
+    REQUIRE(batch.count() == 0);
+    kv.write(batch);
+  }
+  {
+    // 关闭时写出的大memTable在重新打开后完整可读
+    KVStore<uint64_t, std::string> kv(baseDir);
+    REQUIRE(kv.get(1).second == "overwritten in batch");
+    REQUIRE(kv.get(2).first == false);
+    for (uint64_t key = 3; key <= 1000; ++key) {
+      REQUIRE(kv.get(key).second == fmt::format("batch value = {}", key));
+    }
+  }
+  fs::remove_all(baseDir);
+
+  // 数据量超过单个sst的index block容量(约8MB)的batch
+  {
+    KVStore<uint64_t, std::string> kv(baseDir);
+    WriteBatch<uint64_t> batch;
+    for (uint64_t key = 0; key < 100000; ++key) {
+      batch.put(key, fmt::format("{:0>100}", key));
+    }
+    kv.write(batch);
+  }
+  {
+    KVStore<uint64_t, std::string> kv(baseDir);
+    for (uint64_t key = 0; key < 100000; ++key) {
+      REQUIRE(kv.get(key).second == fmt::format("{:0>100}", key));
+    }
+  }
+  fs::remove_all(baseDir);
+
+  // 崩溃后重放: 完整的batch全部恢复, 被截断的batch全部丢弃
+  fs::create_directories(baseDir + "log/");
+  {
+    WALWriter wal(baseDir + "log/wal_0.log");
+    WriteBatch<uint64_t> batch;
+    for (uint64_t key = 0; key < 100; ++key) {
+      batch.put(key, fmt::format("first = {}", key));
+    }
+    wal.addRecord(batch.data(), false);
+    batch.clear();
+    for (uint64_t key = 50; key < 150; ++key) {
+      batch.put(key, fmt::format("second = {}", key));
+    }
+    std::string record(batch.data());
+    record.resize(record.size() / 2);
+    wal.addRecord(record, false);
+  }
+  {
+    KVStore<uint64_t, std::string> kv(baseDir);
+    for (uint64_t key = 0; key < 150; ++key) {
+      auto [hasKey, value] = kv.get(key);
+      REQUIRE(hasKey == (key < 100));
+      if (hasKey) {
+        REQUIRE(value == fmt::format("first = {}", key));
+      }
+    }
+  }
+  fs::remove_all(baseDir);
+}
+
 TEST_CASE("test_endian", "test_endian") {
   std::vector<uint8_t> vec;
   uint16_t num = 0xAA55;
@@ -2,14 +2,20 @@
 
 #include <fmt/format.h>
 
+#include <algorithm>
+#include <atomic>
 #include <bitset>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <list>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <sys/time.h>
 
+#include "Arena.hpp"
 #include "SSTable.hpp"
 #include "SkipList.hpp"
 
@@ -121,17 +127,132 @@ TEST_CASE("test_SSTable", "test_SSTable") {
   table.writeToFile("sstable_test.txt",
                     uint64_t(1000000 * now.tv_sec + now.tv_usec));
 
-  auto str = readSSTableFromFile<uint64_t>("sstable_test.txt", 0);
+  auto [found, str] = readSSTableFromFile<uint64_t>("sstable_test.txt", 1);
+  REQUIRE(found == true);
   REQUIRE(str.size() == 18);
   REQUIRE(str == std::string("key = 1, value = 1"));
-  str = readSSTableFromFile<uint64_t>("sstable_test.txt", 18);
+  std::tie(found, str) = readSSTableFromFile<uint64_t>("sstable_test.txt", 2);
   REQUIRE(str == std::string("key = 2, value = 2"));
 
   // 尝试读取最后一个value
   auto lastStr = fmt::format("key = {}, value = {}", range - 1, range - 1);
-  std::cout << "valueLen = " << valueLen << '\n';
-  std::cout << "lastStr's len = " << lastStr.size() << '\n';
-  str = readSSTableFromFile<uint64_t>("sstable_test.txt",
-                                      valueLen - lastStr.size());
+  std::tie(found, str) =
+      readSSTableFromFile<uint64_t>("sstable_test.txt", range - 1);
+  REQUIRE(found == true);
   REQUIRE(str == lastStr);
-}
\ No newline at end of file
+
+  // 每个key都能在所在的block中找到
+  for (auto i = start; i < range; ++i) {
+    std::tie(found, str) = readSSTableFromFile<uint64_t>("sstable_test.txt", i);
+    REQUIRE(found == true);
+    REQUIRE(str == fmt::format("key = {}, value = {}", i, i));
+  }
+
+  // 不存在的key
+  REQUIRE(readSSTableFromFile<uint64_t>("sstable_test.txt", 0).first == false);
+  REQUIRE(readSSTableFromFile<uint64_t>("sstable_test.txt", range).first ==
+          false);
+}
+TEST_CASE("test_SkipList_clear_reuse", "test_SkipList_clear_reuse") {
+  SkipList<uint64_t, std::string> list;
+  constexpr size_t range = 1024;
+  constexpr size_t start = 1;
+  // 多轮insert/clear, clear后arena复用且数据不残留
+  for (size_t round = 0; round < 4; ++round) {
+    for (size_t i = start; i < range; ++i) {
+      REQUIRE(true ==
+              list.insert(i, fmt::format("round = {}, value = {}", round, i)));
+    }
+    REQUIRE(list.nodeNum() == range - start);
+    for (size_t i = start; i < range; ++i) {
+      auto [ret, value] = list.search(i);
+      REQUIRE(ret == true);
+      REQUIRE(value == fmt::format("round = {}, value = {}", round, i));
+    }
+    list.clear();
+    REQUIRE(list.nodeNum() == 0);
+    REQUIRE(list.getMemSize() == 0);
+    REQUIRE(false == list.search(start).first);
+  }
+
+  // 覆盖写: 新value生效, 内存占用按新value计算
+  REQUIRE(true == list.insert(1, std::string(100, 'a')));
+  REQUIRE(false == list.insert(1, std::string(10, 'b')));
+  REQUIRE(list.search(1).second == std::string(10, 'b'));
+  REQUIRE(list.getMemSize() == sizeof(uint64_t) + 10);
+}
+
+TEST_CASE("test_SkipList_concurrent", "test_SkipList_concurrent") {
+  SkipList<uint64_t, std::string> list;
+  constexpr size_t threadNum = 4;
+  constexpr size_t perThread = 2048;
+  std::vector<std::thread> threads;
+  // 每个线程写互不相交的key, 同时所有线程都写一批相同的key
+  for (size_t t = 0; t < threadNum; ++t) {
+    threads.emplace_back([&list, t]() {
+      for (size_t i = 0; i < perThread; ++i) {
+        uint64_t key = 1 + i * threadNum + t;
+        list.insert(key, fmt::format("key = {}, value = {}", key, key));
+        list.insert(perThread * threadNum + 1 + i % 64, fmt::format("{}", t));
+        list.search(1 + i * threadNum);
+      }
+    });
+  }
+  for (auto &th : threads) {
+    th.join();
+  }
+
+  REQUIRE(list.nodeNum() == perThread * threadNum + 64);
+  for (uint64_t key = 1; key <= perThread * threadNum; ++key) {
+    auto [ret, value] = list.search(key);
+    REQUIRE(ret == true);
+    REQUIRE(value == fmt::format("key = {}, value = {}", key, key));
+  }
+  std::list<std::pair<uint64_t, std::string>> result;
+  list.scan(1, perThread * threadNum + 64, result);
+  REQUIRE(result.size() == list.nodeNum());
+  uint64_t prev = 0;
+  for (auto &[k, v] : result) {
+    REQUIRE(k > prev);
+    prev = k;
+  }
+  REQUIRE(list.getMaxKey().second == perThread * threadNum + 64);
+}
+
+TEST_CASE("test_ConcurrentArena", "test_ConcurrentArena") {
+  ConcurrentArena arena;
+  constexpr size_t threadNum = 8;
+  constexpr size_t perThread = 4096;
+  std::vector<std::vector<std::pair<char *, size_t>>> allocated(threadNum);
+  std::atomic<bool> misaligned = false;
+  std::vector<std::thread> threads;
+  // 大小不同的分配, 包括超过shard一段内存1/4的大对象
+  for (size_t t = 0; t < threadNum; ++t) {
+    threads.emplace_back([&arena, &allocated, &misaligned, t]() {
+      for (size_t i = 0; i < perThread; ++i) {
+        size_t bytes = 1 + (i * 37 + t) % (i % 64 == 0 ? 2048 : 200);
+        char *mem = arena.allocateAligned(bytes);
+        if (reinterpret_cast<uintptr_t>(mem) % sizeof(void *) != 0) {
+          misaligned = true;
+        }
+        ::memset(mem, static_cast<int>(t), bytes);
+        allocated[t].emplace_back(mem, bytes);
+      }
+    });
+  }
+  for (auto &th : threads) {
+    th.join();
+  }
+  REQUIRE(misaligned == false);
+  // 各线程分配的内存互不重叠: 没有被其它线程覆盖
+  for (size_t t = 0; t < threadNum; ++t) {
+    for (auto [mem, bytes] : allocated[t]) {
+      REQUIRE(std::all_of(mem, mem + bytes, [t](char c) {
+        return c == static_cast<char>(t);
+      }));
+    }
+  }
+  REQUIRE(arena.memoryUsage() > 0);
+  arena.reset();
+  REQUIRE(arena.allocateAligned(16) != nullptr);
+}